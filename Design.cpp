@@ -4,8 +4,53 @@
 #include <unordered_map>
 #include <mutex>
 #include <sstream>
+#include <cstdint>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <condition_variable>
+#include <deque>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <limits>
+#include <ctime>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 using namespace std;
 
+// Index of the lowest set bit in a non-zero word.
+static inline int lowestSetBit(uint64_t word) {
+    return __builtin_ctzll(word);
+}
+
+// Number of set bits in a word.
+static inline int countBits(uint64_t word) {
+    return __builtin_popcountll(word);
+}
+
+// Index of the highest set bit in a non-zero word.
+static inline int highestSetBit(uint64_t word) {
+    return 63 - __builtin_clzll(word);
+}
+
 ///////////////////////////////////////////////////////////
 // MachineKind: This enum class identifies the kind of machine.
 ///////////////////////////////////////////////////////////
@@ -25,19 +70,47 @@ static string kindToString(MachineKind kind) {
     }
 }
 
+// Helper to parse a kind name; anything unrecognised is treated as a Truck.
+static MachineKind kindFromString(const string& name) {
+    if (name == "Bike") return MachineKind::Bike;
+    if (name == "Car")  return MachineKind::Car;
+    return MachineKind::Truck;
+}
+
+// Helper to show a stay length such as "2d 3h 5m".
+static string formatMinutes(long long minutes) {
+    if (minutes < 0) minutes = 0;
+    string text;
+    if (minutes >= 24 * 60) text += to_string(minutes / (24 * 60)) + "d ";
+    if (minutes >= 60) text += to_string(minutes / 60 % 24) + "h ";
+    return text + to_string(minutes % 60) + "m";
+}
+
+// Helper to show the time of day of a minute count, e.g. "07:45".
+static string formatTimeOfDay(long long minute) {
+    int ofDay = int((minute % (24 * 60) + 24 * 60) % (24 * 60));
+    char label[16];
+    snprintf(label, sizeof(label), "%02d:%02d", ofDay / 60, ofDay % 60);
+    return label;
+}
+
 ///////////////////////////////////////////////////////////
 // Machine: Represents a vehicle-like entity.
 ///////////////////////////////////////////////////////////
+// Marks "no machine" wherever a 32-bit machine handle is stored.
+const uint32_t kNoHandle = 0xFFFFFFFFu;
+
 class Machine {
 public:
     string identifier; // e.g., license plate
     MachineKind kind;
+    uint32_t handle;   // Interned identifier, see IdTable
 
     // Added default constructor
-    Machine() : identifier(""), kind(MachineKind::Bike) {}
+    Machine() : identifier(""), kind(MachineKind::Bike), handle(kNoHandle) {}
 
     // Constructor assigns unique identifier and machine kind.
-    Machine(const string& id, MachineKind mkind) : identifier(id), kind(mkind) {}
+    Machine(const string& id, MachineKind mkind) : identifier(id), kind(mkind), handle(kNoHandle) {}
 
     // Determines how many slots (spots) this machine needs.
     int slotsNeeded() const {
@@ -45,6 +118,286 @@ public:
     }
 };
 
+///////////////////////////////////////////////////////////
+// ChunkedArray: A growable array kept in fixed-size chunks. Growing
+// only allocates another chunk and never moves what is already there,
+// so no single append pays for copying every element before it.
+///////////////////////////////////////////////////////////
+const size_t kChunkShift = 12;  // 4096 elements per chunk
+const size_t kChunkSize = size_t(1) << kChunkShift;
+
+template <typename T>
+class ChunkedArray {
+public:
+    ChunkedArray() : count(0) {}
+
+    size_t size() const { return count; }
+    T& operator[](size_t i) { return chunks[i >> kChunkShift][i & (kChunkSize - 1)]; }
+    const T& operator[](size_t i) const { return chunks[i >> kChunkShift][i & (kChunkSize - 1)]; }
+
+    void push_back(const T& value) {
+        reserve(count + 1);
+        (*this)[count++] = value;
+    }
+
+    // Grow with default values, or shrink (dropped elements are reset).
+    void resize(size_t n) {
+        reserve(n);
+        for (size_t i = n; i < count; ++i) (*this)[i] = T();
+        count = n;
+    }
+
+    void reserve(size_t n) {
+        while (chunks.size() << kChunkShift < n) chunks.emplace_back(new T[kChunkSize]());
+    }
+
+    void swap(ChunkedArray& other) {
+        chunks.swap(other.chunks);
+        std::swap(count, other.count);
+    }
+
+private:
+    vector<unique_ptr<T[]>> chunks;
+    size_t count;
+};
+
+///////////////////////////////////////////////////////////
+// Span: A pointer and a length, viewing part of an array owned
+// somewhere else (e.g. one level's share of the garage's flat arrays).
+///////////////////////////////////////////////////////////
+template <typename T>
+struct Span {
+    T* first;
+    size_t count;
+
+    Span() : first(nullptr), count(0) {}
+    Span(T* start, size_t n) : first(start), count(n) {}
+
+    size_t size() const { return count; }
+    T* data() const { return first; }
+    T* begin() const { return first; }
+    T* end() const { return first + count; }
+    T& operator[](size_t i) const { return first[i]; }
+};
+
+///////////////////////////////////////////////////////////
+// IdTable: Interns identifiers so each plate is stored exactly once.
+// Slots and indexes refer to a machine by its 32-bit handle. Handles
+// are reference counted; when the last reference goes, the handle is
+// recycled. Per-handle data sits in ChunkedArrays, so adding a plate
+// never copies the ones already interned.
+//
+// Lookup is a bucketized cuckoo index of handles: a plate can only sit
+// in one of two 4-entry buckets, so a find looks at no more than eight
+// entries (sixteen while the index is growing). Growing doesn't stop
+// the world: a twice-as-big index is allocated and every later insert
+// or erase moves a few buckets of the old one across.
+///////////////////////////////////////////////////////////
+const size_t kCuckooBucketSize = 4;
+const int kCuckooMaxKicks = 128;          // Evictions before an insert forces a rebuild
+const size_t kCuckooMigrateBuckets = 8;   // Old buckets moved per insert/erase while growing
+
+class IdTable {
+public:
+    IdTable() : live(0), resizes(0), current(4), migrated(0), kickCursor(0) {}
+
+    // Handle for an identifier, adding it if needed. Takes one reference.
+    uint32_t intern(const string& id) {
+        size_t hash = hasher(id);
+        uint32_t found = lookup(id, hash);
+        if (found != kNoHandle) {
+            refs[found]++;
+            return found;
+        }
+        uint32_t handle;
+        if (!freeHandles.empty()) {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+            names[handle] = id;
+            hashes[handle] = hash;
+            refs[handle] = 1;
+        } else {
+            handle = uint32_t(names.size());
+            names.push_back(id);
+            hashes.push_back(hash);
+            refs.push_back(1);
+        }
+        migrateSome();
+        if ((live + 1) * 8 > current.cells.size() * 7) startGrow();
+        place(handle);
+        live++;
+        return handle;
+    }
+
+    // Handle for an identifier, or kNoHandle if it isn't interned.
+    uint32_t find(const string& id) const {
+        return lookup(id, hasher(id));
+    }
+
+    void retain(uint32_t handle) { refs[handle]++; }
+
+    // Drop one reference. Returns true if the handle was freed.
+    bool release(uint32_t handle) {
+        if (--refs[handle] > 0) return false;
+        if (!current.remove(handle, hashes[handle])) previous.remove(handle, hashes[handle]);
+        names[handle].clear();
+        freeHandles.push_back(handle);
+        live--;
+        migrateSome();
+        return true;
+    }
+
+    const string& name(uint32_t handle) const { return names[handle]; }
+    size_t size() const { return live; }
+    size_t resizeCount() const { return resizes; }
+
+    // Size everything for count identifiers up front (e.g. before a bulk load).
+    void reserve(size_t count) {
+        names.reserve(count);
+        hashes.reserve(count);
+        refs.reserve(count);
+        size_t buckets = current.buckets();
+        while (count * 8 > buckets * kCuckooBucketSize * 7) buckets *= 2;
+        if (buckets != current.buckets() || growing()) rebuild(buckets, kNoHandle);
+    }
+
+private:
+    // Power-of-two array of buckets, each holding kCuckooBucketSize handles.
+    struct CuckooIndex {
+        vector<uint32_t> cells;
+        size_t mask;
+
+        explicit CuckooIndex(size_t buckets = 0)
+            : cells(buckets * kCuckooBucketSize, kNoHandle), mask(buckets ? buckets - 1 : 0) {}
+
+        size_t buckets() const { return cells.size() / kCuckooBucketSize; }
+        size_t first(size_t hash) const { return hash & mask; }
+        size_t second(size_t hash) const {
+            return size_t((uint64_t(hash) * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+        }
+
+        bool remove(uint32_t handle, size_t hash) {
+            if (cells.empty()) return false;
+            for (size_t bucket : {first(hash), second(hash)}) {
+                for (size_t i = 0; i < kCuckooBucketSize; ++i) {
+                    uint32_t& cell = cells[bucket * kCuckooBucketSize + i];
+                    if (cell == handle) {
+                        cell = kNoHandle;
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+    };
+
+    hash<string> hasher;
+    size_t live;
+    size_t resizes;
+    ChunkedArray<string> names;   // The one copy of each identifier
+    ChunkedArray<size_t> hashes;  // Cached so moving entries doesn't rehash strings
+    ChunkedArray<uint32_t> refs;
+    vector<uint32_t> freeHandles;
+    CuckooIndex current;          // New entries always go here
+    CuckooIndex previous;         // Being drained while growing, else empty
+    size_t migrated;              // Buckets of previous already drained
+    unsigned kickCursor;          // Rotates which entry of a full bucket gets evicted
+
+    bool growing() const { return !previous.cells.empty(); }
+
+    uint32_t lookup(const string& id, size_t hash) const {
+        for (const CuckooIndex* idx : {&current, &previous}) {
+            if (idx->cells.empty()) continue;
+            for (size_t bucket : {idx->first(hash), idx->second(hash)}) {
+                const uint32_t* cell = &idx->cells[bucket * kCuckooBucketSize];
+                for (size_t i = 0; i < kCuckooBucketSize; ++i) {
+                    uint32_t h = cell[i];
+                    if (h != kNoHandle && hashes[h] == hash && names[h] == id) return h;
+                }
+            }
+        }
+        return kNoHandle;
+    }
+
+    // Put handle into idx, evicting entries to their other bucket as needed.
+    // Returns the handle left without a home if the kick limit is hit.
+    uint32_t insertInto(CuckooIndex& idx, uint32_t handle) {
+        size_t bucket = idx.first(hashes[handle]);
+        for (int kick = 0; kick <= kCuckooMaxKicks; ++kick) {
+            size_t hash = hashes[handle];
+            for (size_t b : {idx.first(hash), idx.second(hash)}) {
+                uint32_t* cell = &idx.cells[b * kCuckooBucketSize];
+                for (size_t i = 0; i < kCuckooBucketSize; ++i) {
+                    if (cell[i] == kNoHandle) {
+                        cell[i] = handle;
+                        return kNoHandle;
+                    }
+                }
+            }
+            // Both buckets full: evict someone and send it to its other bucket.
+            uint32_t& victim = idx.cells[bucket * kCuckooBucketSize + (kickCursor++ % kCuckooBucketSize)];
+            swap(victim, handle);
+            size_t victimHash = hashes[handle];
+            bucket = (idx.first(victimHash) == bucket) ? idx.second(victimHash) : idx.first(victimHash);
+        }
+        return handle;
+    }
+
+    void place(uint32_t handle) {
+        uint32_t homeless = insertInto(current, handle);
+        // Very unlikely below the load limit; fall back to a full rebuild.
+        if (homeless != kNoHandle) rebuild(current.buckets() * 2, homeless);
+    }
+
+    void startGrow() {
+        if (growing()) migrateSome(previous.buckets());
+        previous = move(current);
+        current = CuckooIndex(previous.buckets() * 2);
+        migrated = 0;
+        resizes++;
+    }
+
+    // Move up to count buckets of the old index into the current one.
+    void migrateSome(size_t count = kCuckooMigrateBuckets) {
+        if (!growing()) return;
+        for (; count > 0 && migrated < previous.buckets(); --count, ++migrated) {
+            for (size_t i = 0; i < kCuckooBucketSize; ++i) {
+                uint32_t& cell = previous.cells[migrated * kCuckooBucketSize + i];
+                if (cell == kNoHandle) continue;
+                uint32_t handle = cell;
+                cell = kNoHandle;
+                place(handle);
+                if (!growing()) return;  // place() rebuilt everything
+            }
+        }
+        if (migrated == previous.buckets()) previous = CuckooIndex();
+    }
+
+    // Re-insert every entry (plus extra, if any) into a fresh index.
+    void rebuild(size_t buckets, uint32_t extra) {
+        vector<uint32_t> all;
+        all.reserve(live + 1);
+        for (const CuckooIndex* idx : {&current, &previous}) {
+            for (uint32_t h : idx->cells) {
+                if (h != kNoHandle) all.push_back(h);
+            }
+        }
+        if (extra != kNoHandle) all.push_back(extra);
+        previous = CuckooIndex();
+        for (bool placed = false; !placed; buckets *= 2) {
+            current = CuckooIndex(buckets);
+            placed = true;
+            for (uint32_t h : all) {
+                if (insertInto(current, h) != kNoHandle) {
+                    placed = false;
+                    break;
+                }
+            }
+        }
+        resizes++;
+    }
+};
+
 ///////////////////////////////////////////////////////////
 // Slot: Represents an individual parking spot.
 ///////////////////////////////////////////////////////////
@@ -53,15 +406,17 @@ public:
     int levelIndex;   // Which level/floor
     int slotIndex;    // Spot index on that level
     bool isOccupied;  // Whether a machine is present
-    string occupantId; // ID of occupant machine
+    bool isBikeZone;  // Split into bike bays (occupants live in the BikePool)
+    uint32_t occupant; // Handle of occupant machine
 
     Slot(int level, int index)
-        : levelIndex(level), slotIndex(index), isOccupied(false) {}
+        : levelIndex(level), slotIndex(index), isOccupied(false), isBikeZone(false),
+          occupant(kNoHandle) {}
 
     // Marks this slot as occupied by a given machine.
-    bool occupySlot(const string& machineId) {
+    bool occupySlot(uint32_t handle) {
         if (isOccupied) return false;
-        occupantId = machineId;
+        occupant = handle;
         isOccupied = true;
         return true;
     }
@@ -69,33 +424,355 @@ public:
     // Frees up this slot.
     bool vacateSlot() {
         if (!isOccupied) return false;
-        occupantId.clear();
+        occupant = kNoHandle;
         isOccupied = false;
+        isBikeZone = false;
+        return true;
+    }
+
+    // Turns this free slot into bike bays.
+    bool convertToBikeZone() {
+        if (isOccupied) return false;
+        isOccupied = true;
+        isBikeZone = true;
+        return true;
+    }
+};
+
+///////////////////////////////////////////////////////////
+// OccupancyBitmap: One bit per slot, set while the slot is occupied.
+// Lets an allocator look at 64 slots with a single word operation.
+//
+// A second layer summarises the words, one bit per word: "has a set
+// bit", "has a clear bit", "has a clear pair starting here" and "has a
+// clear bit with no clear neighbour". Finding the first word worth
+// looking at is then a ctz over the summary, so a search touches two
+// words per 4096 slots instead of 64.
+//
+// The words either belong to the bitmap or live in an array owned by
+// someone else (a FlatLevelStore); the summaries are always its own.
+///////////////////////////////////////////////////////////
+class OccupancyBitmap {
+public:
+    OccupancyBitmap() : bitCount(0), setBits(0), pairWords(0) {}
+    explicit OccupancyBitmap(int totalBits)
+        : bitCount(totalBits), setBits(0), pairWords(0), ownedWords((totalBits + 63) / 64, 0),
+          words(ownedWords.data(), ownedWords.size()) {
+        buildSummaries();
+    }
+
+    // View zeroed words kept elsewhere; (totalBits + 63) / 64 of them.
+    OccupancyBitmap(int totalBits, uint64_t* storage)
+        : bitCount(totalBits), setBits(0), pairWords(0), words(storage, (totalBits + 63) / 64) {
+        buildSummaries();
+    }
+
+    OccupancyBitmap(OccupancyBitmap&&) = default;
+    OccupancyBitmap& operator=(OccupancyBitmap&&) = default;
+
+    // Follow external words that have moved (same contents).
+    void rebind(uint64_t* storage) { words.first = storage; }
+
+    int size() const { return bitCount; }
+
+    bool test(int index) const {
+        return (words[index >> 6] >> (index & 63)) & 1;
+    }
+
+    void set(int index) {
+        uint64_t bit = uint64_t(1) << (index & 63);
+        if (words[index >> 6] & bit) return;
+        words[index >> 6] |= bit;
+        setBits++;
+        refreshAround(index >> 6);
+    }
+
+    void clear(int index) {
+        uint64_t bit = uint64_t(1) << (index & 63);
+        if (!(words[index >> 6] & bit)) return;
+        words[index >> 6] &= ~bit;
+        setBits--;
+        refreshAround(index >> 6);
+    }
+
+    // How many bits (occupied slots) are set.
+    int countSet() const { return setBits; }
+
+    // Constant-time answers to "could anything fit here at all?".
+    bool hasClear() const { return setBits < bitCount; }
+    bool hasClearPair() const { return pairWords > 0; }
+
+    // Lowest set bit, or -1 if none is set.
+    int findFirstSet() const {
+        int w = firstSummaryWord(setSummary);
+        return w < 0 ? -1 : w * 64 + lowestSetBit(words[w]);
+    }
+
+    // Lowest clear bit, or -1 if every slot is occupied.
+    int findFirstClear() const {
+        int w = firstSummaryWord(clearSummary);
+        return w < 0 ? -1 : w * 64 + lowestSetBit(freeMask(w));
+    }
+
+    // Lowest index i such that i and i+1 are both clear, or -1.
+    int findFirstClearPair() const {
+        int w = firstSummaryWord(pairSummary);
+        return w < 0 ? -1 : w * 64 + lowestSetBit(pairMask(w));
+    }
+
+    // Lowest clear bit whose neighbours are both set (or off the end), or
+    // -1. Filling such a hole can't break up a clear pair.
+    int findFirstLoneClear() const {
+        int w = firstSummaryWord(loneSummary);
+        return w < 0 ? -1 : w * 64 + lowestSetBit(loneMask(w));
+    }
+
+    Span<const uint64_t> rawWords() const { return Span<const uint64_t>(words.data(), words.size()); }
+
+private:
+    int bitCount;
+    int setBits;
+    int pairWords;                   // Set bits in pairSummary
+    vector<uint64_t> ownedWords;     // Empty when the words live elsewhere
+    Span<uint64_t> words;
+    vector<uint64_t> setSummary;     // Bit w: words[w] has a set bit
+    vector<uint64_t> clearSummary;   // Bit w: words[w] has a clear bit
+    vector<uint64_t> pairSummary;    // Bit w: a clear pair starts in words[w]
+    vector<uint64_t> loneSummary;    // Bit w: words[w] has a clear bit with no clear neighbour
+
+    // Clear bits of word w as set bits, ignoring the padding past bitCount.
+    uint64_t freeMask(size_t w) const {
+        uint64_t free = ~words[w];
+        int tail = bitCount - int(w * 64);
+        if (tail < 64) free &= (uint64_t(1) << tail) - 1;
+        return free;
+    }
+
+    // Positions in word w where a clear pair starts.
+    uint64_t pairMask(size_t w) const {
+        uint64_t free = freeMask(w);
+        uint64_t pairs = free & (free >> 1);
+        // A pair can also straddle this word and the next one.
+        if (w + 1 < words.size() && (free >> 63) && (freeMask(w + 1) & 1)) {
+            pairs |= uint64_t(1) << 63;
+        }
+        return pairs;
+    }
+
+    // Clear bits of word w whose neighbours, in this word or the next
+    // and previous ones, are set.
+    uint64_t loneMask(size_t w) const {
+        uint64_t free = freeMask(w);
+        uint64_t below = free << 1;
+        uint64_t above = free >> 1;
+        if (w > 0) below |= freeMask(w - 1) >> 63;
+        if (w + 1 < words.size()) above |= (freeMask(w + 1) & 1) << 63;
+        return free & ~below & ~above;
+    }
+
+    void buildSummaries() {
+        size_t summaryWords = (words.size() + 63) / 64;
+        setSummary.assign(summaryWords, 0);
+        clearSummary.assign(summaryWords, 0);
+        pairSummary.assign(summaryWords, 0);
+        loneSummary.assign(summaryWords, 0);
+        for (size_t w = 0; w < words.size(); ++w) {
+            setBits += countBits(words[w]);
+            refreshSummary(w);
+        }
+    }
+
+    static int firstSummaryWord(const vector<uint64_t>& summary) {
+        for (size_t s = 0; s < summary.size(); ++s) {
+            if (summary[s]) return int(s * 64) + lowestSetBit(summary[s]);
+        }
+        return -1;
+    }
+
+    // Word w changed; pairs and lone bits next to it may have too.
+    void refreshAround(size_t w) {
+        refreshSummary(w);
+        if (w > 0) refreshSummary(w - 1);
+        if (w + 1 < words.size()) refreshSummary(w + 1);
+    }
+
+    void refreshSummary(size_t w) {
+        uint64_t bit = uint64_t(1) << (w & 63);
+        uint64_t& hasSet = setSummary[w >> 6];
+        uint64_t& hasClear = clearSummary[w >> 6];
+        uint64_t& hasPair = pairSummary[w >> 6];
+        uint64_t& hasLone = loneSummary[w >> 6];
+        hasSet = words[w] ? (hasSet | bit) : (hasSet & ~bit);
+        hasClear = freeMask(w) ? (hasClear | bit) : (hasClear & ~bit);
+        hasLone = loneMask(w) ? (hasLone | bit) : (hasLone & ~bit);
+        bool pair = pairMask(w) != 0;
+        if (pair != bool(hasPair & bit)) {
+            pairWords += pair ? 1 : -1;
+            hasPair ^= bit;
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////
+// BikePool: Splits slots into bike bays so bikes don't each take a
+// full slot. A slot joins the pool when its first bike arrives and
+// leaves it when its last bike departs. Slots with an open bay are
+// tracked in a bitmap, so partially used bike slots fill first.
+///////////////////////////////////////////////////////////
+const int kBikeBaysPerSlot = 3;
+const int kMaxBikeBaysPerSlot = 64;  // Upper bound accepted from files
+
+class BikePool {
+public:
+    int baysPerSlot;
+
+    BikePool(int totalSlots, int baysEach)
+        : baysPerSlot(baysEach), openBays(0), bays(size_t(totalSlots) * baysEach, kNoHandle),
+          bikeCount(totalSlots, 0), hasOpenBay(totalSlots) {}
+
+    // A bike slot that still has an open bay, or -1.
+    int partialSlot() const { return hasOpenBay.findFirstSet(); }
+
+    bool isBikeSlot(int slot) const { return bikeCount[slot] > 0; }
+    bool hasRoom(int slot) const { return bikeCount[slot] < baysPerSlot; }
+    int bikesIn(int slot) const { return bikeCount[slot]; }
+    int openBayCount() const { return openBays; }
+
+    // Put a bike in the first open bay of the slot. Returns the bay, or -1.
+    int park(int slot, uint32_t handle) {
+        if (!hasRoom(slot)) return -1;
+        int bay = 0;
+        while (bayOccupant(slot, bay) != kNoHandle) ++bay;
+        return parkInBay(slot, bay, handle);
+    }
+
+    // Put a bike in a specific bay (used when restoring a snapshot).
+    int parkInBay(int slot, int bay, uint32_t handle) {
+        if (bay < 0 || bay >= baysPerSlot || bayOccupant(slot, bay) != kNoHandle) return -1;
+        if (bikeCount[slot] == 0) openBays += baysPerSlot;
+        bays[size_t(slot) * baysPerSlot + bay] = handle;
+        bikeCount[slot]++;
+        openBays--;
+        refresh(slot);
+        return bay;
+    }
+
+    // Take a bike out of the slot. slotEmptied reports whether the slot
+    // no longer holds any bikes and should go back to general use.
+    bool release(int slot, uint32_t handle, bool& slotEmptied) {
+        slotEmptied = false;
+        int b = bayOf(slot, handle);
+        if (b < 0) return false;
+        bays[size_t(slot) * baysPerSlot + b] = kNoHandle;
+        bikeCount[slot]--;
+        openBays++;
+        if (bikeCount[slot] == 0) {
+            openBays -= baysPerSlot;
+            slotEmptied = true;
+        }
+        refresh(slot);
         return true;
     }
+
+    // Who is in a bay; kNoHandle if the bay is open.
+    uint32_t bayOccupant(int slot, int bay) const {
+        return bays[size_t(slot) * baysPerSlot + bay];
+    }
+
+    // Which bay of the slot holds the bike, or -1.
+    int bayOf(int slot, uint32_t handle) const {
+        if (bikeCount[slot] == 0) return -1;
+        for (int b = 0; b < baysPerSlot; ++b) {
+            if (bayOccupant(slot, b) == handle) return b;
+        }
+        return -1;
+    }
+
+private:
+    int openBays;                  // Open bays across all bike slots
+    vector<uint32_t> bays;         // Occupant of each bay, baysPerSlot per slot
+    vector<int> bikeCount;         // Bikes currently in each slot
+    OccupancyBitmap hasOpenBay;    // Bike slots that can take another bike
+
+    void refresh(int slot) {
+        if (bikeCount[slot] > 0 && bikeCount[slot] < baysPerSlot) hasOpenBay.set(slot);
+        else hasOpenBay.clear(slot);
+    }
 };
 
 ///////////////////////////////////////////////////////////
-// Level: A single floor that contains multiple slots.
+// Level: A single floor that contains multiple slots. Its slots and
+// occupancy words are views into a FlatLevelStore, which keeps every
+// level's share in one array.
 ///////////////////////////////////////////////////////////
 class Level {
 public:
     int levelIndex;           // Which level is this?
-    vector<Slot> slotList;    // All slots on this level
+    Span<Slot> slotList;      // All slots on this level
+    BikePool bikePool;        // Bike bays carved out of slots
+    OccupancyBitmap occupancy; // Mirror of Slot::isOccupied, for fast reads
 
-    Level(int index, int totalSlots) : levelIndex(index) {
-        for (int i = 0; i < totalSlots; ++i) {
-            slotList.emplace_back(index, i);
-        }
+    // slots must already be constructed; occupancyWords must be zeroed.
+    Level(int index, Span<Slot> slots, uint64_t* occupancyWords, int bikeBays = kBikeBaysPerSlot)
+        : levelIndex(index), slotList(slots), bikePool(int(slots.size()), bikeBays),
+          occupancy(int(slots.size()), occupancyWords),
+          dirtyLow(0), dirtyHigh(int(slots.size()) - 1) {}
+
+    // Follow the store's arrays after they have moved.
+    void rebind(Slot* slots, uint64_t* occupancyWords) {
+        slotList.first = slots;
+        occupancy.rebind(occupancyWords);
     }
 
     // Find suitable slot(s) for a machine.
+    // Bikes go to a partly used bike slot first, then to the first free slot.
     // If only 1 slot is needed, we return the first free slot.
     // If 2 slots are needed (e.g., truck), we look for 2 adjacent free slots.
-    vector<int> spotsAvailable(const Machine& machine) {
+    // With keepPairs, a 1-slot machine takes a lone free slot first so
+    // pairs stay open for trucks. Searches the occupancy summary, so big
+    // levels cost little.
+    vector<int> spotsAvailable(const Machine& machine, bool keepPairs = false) const {
+        if (machine.kind == MachineKind::Bike) {
+            int partial = bikePool.partialSlot();
+            if (partial >= 0) return {partial};
+        }
+        if (machine.slotsNeeded() == 1) {
+            int lone = keepPairs ? occupancy.findFirstLoneClear() : -1;
+            if (lone >= 0) return {lone};
+            int first = occupancy.findFirstClear();
+            if (first >= 0) return {first};
+        } else {
+            int first = occupancy.findFirstClearPair();
+            if (first >= 0) return {first, first + 1};
+        }
+        return {};
+    }
+
+    // Whether spotsAvailable could find anything, without searching.
+    bool hasRoomFor(const Machine& machine) const {
+        if (machine.slotsNeeded() == 2) return occupancy.hasClearPair();
+        return occupancy.hasClear() || (machine.kind == MachineKind::Bike && openBikeBays() > 0);
+    }
+
+    // The same search done by walking every Slot. Slow, but simple enough
+    // to serve as the reference the allocator oracle checks against.
+    vector<int> scanForSpots(const Machine& machine, bool keepPairs = false) const {
         int needed = machine.slotsNeeded();
         vector<int> results;
 
+        if (machine.kind == MachineKind::Bike) {
+            int partial = bikePool.partialSlot();
+            if (partial >= 0) return {partial};
+        }
+
+        if (needed == 1 && keepPairs) {
+            for (size_t i = 0; i < slotList.size(); ++i) {
+                bool leftTaken = (i == 0) || slotList[i-1].isOccupied;
+                bool rightTaken = (i + 1 == slotList.size()) || slotList[i+1].isOccupied;
+                if (!slotList[i].isOccupied && leftTaken && rightTaken) return {int(i)};
+            }
+        }
+
         if (needed == 1) {
             for (auto& s : slotList) {
                 if (!s.isOccupied) {
@@ -117,23 +794,35 @@ public:
 
     // Assign the machine to the given slot indices.
     bool assignMachine(const Machine& machine, const vector<int>& slotsToUse) {
+        if (machine.kind == MachineKind::Bike) {
+            return parkBike(machine, slotsToUse[0]);
+        }
         // Check that all required slots are free.
         for (int idx : slotsToUse) {
             if (slotList[idx].isOccupied) return false;
         }
         // Occupy them.
         for (int idx : slotsToUse) {
-            slotList[idx].occupySlot(machine.identifier);
+            slotList[idx].occupySlot(machine.handle);
+            markOccupied(idx);
         }
         return true;
     }
 
-    // Remove the machine with the given ID (identifier) from this level.
-    bool removeMachine(const string& machineId) {
+    // Remove the machine with the given handle from the slots it holds
+    // on this level; only those slots are touched.
+    bool removeMachine(uint32_t handle, const vector<int>& slots) {
         bool removed = false;
-        for (auto& s : slotList) {
-            if (s.isOccupied && s.occupantId == machineId) {
-                s.vacateSlot();
+        for (int idx : slots) {
+            Slot& s = slotList[idx];
+            if (s.isBikeZone) {
+                bool emptied;
+                if (bikePool.release(idx, handle, emptied)) {
+                    if (emptied) vacate(s);
+                    removed = true;
+                }
+            } else if (s.isOccupied && s.occupant == handle) {
+                vacate(s);
                 removed = true;
             }
         }
@@ -142,165 +831,4011 @@ public:
 
     // Count how many slots are currently free.
     int freeSlotsCount() const {
-        int count = 0;
-        for (const auto& s : slotList) {
-            if (!s.isOccupied) count++;
-        }
-        return count;
+        return occupancy.size() - occupancy.countSet();
     }
-};
-
-///////////////////////////////////////////////////////////
-// Garage: Oversees all levels and operations.
-///////////////////////////////////////////////////////////
-class Garage {
-private:
-    // A listing of levels.
-    vector<Level> levels;
-
-    // Store machine location: machine ID -> (levelIndex, vector of slotIndices)
-    unordered_map<string, pair<int, vector<int>>> machineLocations;
-
-    // Also keep a record of the entire machine object, so we can retrieve type.
-    unordered_map<string, Machine> machineCatalog;
 
-    // We lock this for thread-safe operations.
-    mutable mutex garageMutex;
+    // Put a machine straight into a slot while restoring a snapshot.
+    bool restoreSlot(int idx, uint32_t handle) {
+        if (!slotList[idx].occupySlot(handle)) return false;
+        markOccupied(idx);
+        return true;
+    }
 
-public:
-    // Construct a garage with a given number of levels and slots per level.
-    Garage(int totalLevels, int slotsEach) {
-        for (int i = 0; i < totalLevels; ++i) {
-            levels.emplace_back(i, slotsEach);
+    // Put a bike straight into a given bay while restoring a snapshot.
+    bool restoreBike(int idx, int bay, uint32_t handle) {
+        Slot& s = slotList[idx];
+        if (!s.isBikeZone) {
+            if (!s.convertToBikeZone()) return false;
+            markOccupied(idx);
         }
+        return bikePool.parkInBay(idx, bay, handle) >= 0;
     }
 
-    // Provide a helpful list of commands for the user.
-    void showAllCommands() {
-        cout << "\nHere are the commands you can use:" << endl;
-        cout << "  add_machine <id> <type>        (e.g. add_machine ABC123 Car)" << endl;
-        cout << "  unpark_machine <id>            (e.g. unpark_machine ABC123)" << endl;
-        cout << "  check_availability" << endl;
-        cout << "  check_full" << endl;
-        cout << "  locate_machine <id>            (e.g. locate_machine ABC123)" << endl;
-        cout << "  commands                      (Show the list of commands again)" << endl;
-        cout << "  quit" << endl;
-    }
+    // Count bike bays still open in slots already given over to bikes.
+    int openBikeBays() const { return bikePool.openBayCount(); }
 
-    // Attempt to park (store) a machine.
-    bool storeMachine(const Machine& machine) {
-        lock_guard<mutex> lock(garageMutex);
+    // Span of occupancy words changed since the last call, for incremental
+    // redraws. Returns false if nothing changed.
+    bool takeDirtyWords(int& firstWord, int& lastWord) {
+        if (dirtyHigh < dirtyLow) return false;
+        firstWord = dirtyLow >> 6;
+        lastWord = dirtyHigh >> 6;
+        dirtyLow = int(slotList.size());
+        dirtyHigh = -1;
+        return true;
+    }
 
-        // If it's already stored, let the user know.
-        if (machineLocations.count(machine.identifier)) {
-            cout << "Machine with ID " << machine.identifier << " is already parked." << endl;
-            return false;
-        }
+private:
+    int dirtyLow;   // Lowest slot touched since the last takeDirtyWords
+    int dirtyHigh;  // Highest slot touched since the last takeDirtyWords
 
-        // Otherwise, try to find a level with enough free slots.
-        for (auto& lvl : levels) {
-            vector<int> slotIndices = lvl.spotsAvailable(machine);
-            if (!slotIndices.empty() && lvl.assignMachine(machine, slotIndices)) {
-                // Save the location.
-                machineLocations[machine.identifier] = {lvl.levelIndex, slotIndices};
-                // Also store the machine object so we can retrieve its type later.
-                machineCatalog[machine.identifier] = machine;
-
-                cout << "Successfully stored machine '" << machine.identifier << "' on Level "
-                     << lvl.levelIndex << " in slot(s): ";
-                for (int s : slotIndices) cout << s << " ";
-                cout << endl;
-                return true;
-            }
-        }
+    void markOccupied(int idx) {
+        occupancy.set(idx);
+        markDirty(idx);
+    }
 
-        // If we couldn't find space.
-        cout << "No suitable space found for machine ID: " << machine.identifier << "." << endl;
-        return false;
+    void markDirty(int idx) {
+        dirtyLow = min(dirtyLow, idx);
+        dirtyHigh = max(dirtyHigh, idx);
     }
 
-    // Remove an existing machine from the garage.
-    bool unparkMachine(const string& machineId) {
-        lock_guard<mutex> lock(garageMutex);
-        // Check if it's recorded.
-        if (!machineLocations.count(machineId)) {
-            cout << "Machine with ID " << machineId << " not found in the garage." << endl;
+    // Bikes share a slot: start a bike zone in a free slot, or join one.
+    bool parkBike(const Machine& machine, int idx) {
+        Slot& s = slotList[idx];
+        if (!s.isBikeZone && !s.convertToBikeZone()) return false;
+        markOccupied(idx);
+        if (bikePool.park(idx, machine.handle) < 0) {
+            if (bikePool.bikesIn(idx) == 0) vacate(s);
             return false;
         }
+        return true;
+    }
 
-        // Identify the level.
-        int whichLevel = machineLocations[machineId].first;
-        // Let the level remove it.
-        if (levels[whichLevel].removeMachine(machineId)) {
-            machineLocations.erase(machineId);
-            // Remove it from our machineCatalog as well.
-            machineCatalog.erase(machineId);
+    void vacate(Slot& s) {
+        s.vacateSlot();
+        occupancy.clear(s.slotIndex);
+        markDirty(s.slotIndex);
+    }
+};
 
-            cout << "Machine '" << machineId << "' has been removed from Level " << whichLevel << "." << endl;
-            return true;
+///////////////////////////////////////////////////////////
+// FlatLevelStore: Owns the slots and occupancy words of every level,
+// one contiguous array each, plus offset tables saying where each
+// level starts. Levels start on a word boundary so each one's
+// occupancy is a whole number of words. Reports and snapshots walk
+// the garage front to back through a single allocation.
+///////////////////////////////////////////////////////////
+class FlatLevelStore {
+public:
+    FlatLevelStore() : slotOffsets(1, 0), wordOffsets(1, 0) {}
+
+    // Size the arrays up front so adding levels doesn't reallocate.
+    void reserve(const vector<int>& slotCounts) {
+        size_t totalSlots = 0, totalWords = 0;
+        for (int n : slotCounts) {
+            totalSlots += n;
+            totalWords += (n + 63) / 64;
         }
-        return false;
+        slots.reserve(slots.size() + totalSlots);
+        words.reserve(words.size() + totalWords);
     }
 
-    // Show how many free slots each level has.
-    void checkAvailability() {
-        lock_guard<mutex> lock(garageMutex);
-        cout << "\n=== Current Availability ===" << endl;
-        for (auto& lvl : levels) {
-            cout << "Level " << lvl.levelIndex << ": " << lvl.freeSlotsCount() << " slot(s) free." << endl;
+    // Append a level of slotCount slots to levels, backed by this store.
+    void addLevel(vector<Level>& levels, int slotCount, int bikeBays) {
+        int index = int(levels.size());
+        Slot* oldSlots = slots.data();
+        uint64_t* oldWords = words.data();
+        for (int i = 0; i < slotCount; ++i) slots.emplace_back(index, i);
+        words.resize(words.size() + (slotCount + 63) / 64, 0);
+        slotOffsets.push_back(int(slots.size()));
+        wordOffsets.push_back(int(words.size()));
+        levels.emplace_back(index, Span<Slot>(slotData(index), slotCount), wordData(index), bikeBays);
+        // Growing the arrays may have moved them; point every level back in.
+        if (slots.data() != oldSlots || words.data() != oldWords) {
+            for (auto& lvl : levels) lvl.rebind(slotData(lvl.levelIndex), wordData(lvl.levelIndex));
         }
     }
 
-    // Verify if the entire garage is full.
-    void checkIfFull() {
-        lock_guard<mutex> lock(garageMutex);
-        for (auto& lvl : levels) {
+    void swap(FlatLevelStore& other) {
+        slots.swap(other.slots);
+        words.swap(other.words);
+        slotOffsets.swap(other.slotOffsets);
+        wordOffsets.swap(other.wordOffsets);
+    }
+
+    // Every level's occupancy, level after level.
+    const vector<uint64_t>& allWords() const { return words; }
+    int totalSlots() const { return int(slots.size()); }
+
+private:
+    vector<Slot> slots;
+    vector<uint64_t> words;
+    vector<int> slotOffsets;   // Level l's slots are [slotOffsets[l], slotOffsets[l + 1])
+    vector<int> wordOffsets;   // Same for its occupancy words
+
+    Slot* slotData(int level) { return slots.data() + slotOffsets[level]; }
+    uint64_t* wordData(int level) { return words.data() + wordOffsets[level]; }
+};
+
+///////////////////////////////////////////////////////////
+// LevelMapRenderer: Draws a level as [■][□] cells straight from its
+// OccupancyBitmap, a word at a time. Long stretches of the same state
+// collapse into one run cell such as [□ x120]. The output buffer is
+// kept between calls so repeated renders don't allocate.
+///////////////////////////////////////////////////////////
+const int kMapRunThreshold = 8;  // Runs at least this long get compressed
+
+class LevelMapRenderer {
+public:
+    LevelMapRenderer() { buffer.reserve(4096); }
+
+    const string& render(const OccupancyBitmap& occupancy) {
+        buffer.clear();
+        Span<const uint64_t> words = occupancy.rawWords();
+        bool current = false;  // State of the run being counted
+        int run = 0;
+        for (size_t w = 0; w < words.size(); ++w) {
+            int valid = min(64, occupancy.size() - int(w * 64));
+            uint64_t validMask = (valid == 64) ? ~uint64_t(0) : ((uint64_t(1) << valid) - 1);
+            int pos = 0;
+            while (pos < valid) {
+                // Bits from pos onward that differ from the current run.
+                uint64_t diff = ((current ? ~words[w] : words[w]) & validMask) >> pos;
+                if (!diff) {
+                    run += valid - pos;
+                    break;
+                }
+                int step = lowestSetBit(diff);
+                run += step;
+                pos += step;
+                flush(current, run);
+                current = !current;
+                run = 0;
+            }
+        }
+        flush(current, run);
+        return buffer;
+    }
+
+private:
+    string buffer;
+
+    void flush(bool occupied, int run) {
+        const char* cell = occupied ? "\u25A0" : "\u25A1";  // ■ or □
+        if (run >= kMapRunThreshold) {
+            buffer += "[";
+            buffer += cell;
+            buffer += " x" + to_string(run) + "]";
+            return;
+        }
+        for (int i = 0; i < run; ++i) {
+            buffer += "[";
+            buffer += cell;
+            buffer += "]";
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////
+// AllocatorOracle: Differential test harness for the level allocator.
+// Drives a Level with a randomized park/unpark stream, with and without
+// keepPairs, and checks every bitmap search against scanForSpots, the
+// plain walk over the slots. Stops at the first step where placements,
+// results or free counts disagree.
+///////////////////////////////////////////////////////////
+struct OracleReport {
+    long long opsRun = 0;
+    long long parks = 0;
+    long long unparks = 0;
+    bool passed = true;
+    long long failedAtOp = -1;
+    string failure;
+    double seconds = 0.0;
+};
+
+class AllocatorOracle {
+public:
+    AllocatorOracle(int slots, unsigned seed)
+        : slotCount(slots), rng(seed) {}
+
+    OracleReport run(long long totalOps) {
+        FlatLevelStore store;
+        vector<Level> levels;
+        store.addLevel(levels, slotCount, kBikeBaysPerSlot);
+        Level& level = levels[0];
+        vector<pair<uint32_t, vector<int>>> parked;  // Handle and the slots it got
+        uint32_t nextHandle = 0;
+        OracleReport report;
+
+        auto start = chrono::steady_clock::now();
+        for (long long op = 0; op < totalOps && report.passed; ++op) {
+            report.opsRun++;
+            bool doPark = parked.empty() || (rng() % 100) < 55;
+            if (doPark) {
+                report.parks++;
+                // Plates don't matter to a level; only the handle is used.
+                Machine m;
+                m.kind = MachineKind(rng() % 3);
+                m.handle = nextHandle++;
+                bool keepPairs = rng() % 2;
+                vector<int> want = level.scanForSpots(m, keepPairs);
+                vector<int> got = level.spotsAvailable(m, keepPairs);
+                if (want != got) {
+                    fail(report, op, "placement differs for M" + to_string(m.handle) +
+                         " (" + kindToString(m.kind) + (keepPairs ? ", keeping pairs" : "") +
+                         "): slot scan " + describe(want) + ", bitmap " + describe(got));
+                    break;
+                }
+                if (level.scanForSpots(m).empty() == level.hasRoomFor(m)) {
+                    fail(report, op, "hasRoomFor disagrees with the slot scan for M" +
+                         to_string(m.handle) + " (" + kindToString(m.kind) + ")");
+                    break;
+                }
+                if (!got.empty()) {
+                    if (!level.assignMachine(m, got)) {
+                        fail(report, op, "assignMachine refused the slots it offered M" + to_string(m.handle));
+                        break;
+                    }
+                    parked.push_back({m.handle, got});
+                }
+            } else {
+                report.unparks++;
+                size_t pick = rng() % parked.size();
+                uint32_t handle = parked[pick].first;
+                vector<int> held;
+                held.swap(parked[pick].second);
+                parked[pick] = parked.back();
+                parked.pop_back();
+                if (!level.removeMachine(handle, held)) {
+                    fail(report, op, "removeMachine failed for M" + to_string(handle));
+                    break;
+                }
+            }
+            int scannedFree = 0;
+            for (const Slot& s : level.slotList) scannedFree += !s.isOccupied;
+            if (scannedFree != level.freeSlotsCount()) {
+                fail(report, op, "free count differs: slot scan " + to_string(scannedFree) +
+                     ", bitmap " + to_string(level.freeSlotsCount()));
+            }
+        }
+        // Final slot-by-slot comparison catches drift the counts can't see.
+        for (int i = 0; i < slotCount && report.passed; ++i) {
+            if (level.slotList[i].isOccupied != level.occupancy.test(i)) {
+                fail(report, report.opsRun, "bitmap and slots disagree at slot " + to_string(i));
+            }
+        }
+        for (size_t p = 0; p < parked.size() && report.passed; ++p) {
+            for (int i : parked[p].second) {
+                const Slot& s = level.slotList[i];
+                if (!s.isBikeZone && s.occupant != parked[p].first) {
+                    fail(report, report.opsRun, "slot " + to_string(i) + " lost M" + to_string(parked[p].first));
+                }
+            }
+        }
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return report;
+    }
+
+private:
+    int slotCount;
+    mt19937 rng;
+
+    static string describe(const vector<int>& slots) {
+        if (slots.empty()) return "none";
+        string text;
+        for (int s : slots) text += (text.empty() ? "" : ",") + to_string(s);
+        return text;
+    }
+
+    static void fail(OracleReport& report, long long op, const string& why) {
+        report.passed = false;
+        report.failedAtOp = op;
+        report.failure = why;
+    }
+};
+
+// Run the oracle against Level and print a summary.
+static void runAllocatorOracle(long long ops, int slots, unsigned seed) {
+    AllocatorOracle oracle(slots, seed);
+    OracleReport report = oracle.run(ops);
+    cout << "\n=== Allocator Oracle (Level bitmap vs slot scan) ===" << endl;
+    cout << "Ops run: " << report.opsRun << " (" << report.parks << " park, "
+         << report.unparks << " unpark) on " << slots << " slot(s), seed " << seed << endl;
+    if (report.passed) {
+        cout << "Result: PASS" << endl;
+    } else {
+        cout << "Result: FAIL at op " << report.failedAtOp << ": " << report.failure << endl;
+    }
+    if (report.seconds > 0) {
+        cout << "Throughput: " << static_cast<long long>(report.opsRun / report.seconds) << " ops/sec" << endl;
+    }
+}
+
+///////////////////////////////////////////////////////////
+// DashboardRenderer: Redraws only what changed since the last frame.
+// Each level reports the span of words touched since it was last drawn,
+// and only those words are compared with the copy kept from the
+// previous frame. Changes come out either as diff records
+// ("L<level> <first>-<last> occupied|free") or as ANSI cursor moves
+// that patch the grid drawn by the first terminal frame.
+///////////////////////////////////////////////////////////
+enum class DashboardMode {
+    DiffRecords,
+    Terminal
+};
+
+const int kDashboardColumns = 64;  // Slots per terminal row
+
+class DashboardRenderer {
+public:
+    DashboardRenderer() : started(false), lastMode(DashboardMode::DiffRecords), segments(0), bottomRow(1) {}
+
+    // Append this frame's updates to out. Returns how many segments changed.
+    int frame(vector<Level>& levels, DashboardMode mode, string& out) {
+        segments = 0;
+        // A terminal frame patches what the last frame drew, so switching
+        // modes starts over with everything.
+        bool full = !started || mode != lastMode || lastFrame.size() != levels.size();
+        if (full) start(levels, mode, out);
+        for (auto& lvl : levels) {
+            Span<const uint64_t> words = lvl.occupancy.rawWords();
+            int firstWord, lastWord;
+            bool dirty = lvl.takeDirtyWords(firstWord, lastWord);
+            if (full) {
+                firstWord = 0;
+                lastWord = int(words.size()) - 1;
+            } else if (!dirty) {
+                continue;
+            }
+            vector<uint64_t>& previous = lastFrame[lvl.levelIndex];
+            Segment pending;
+            for (int w = firstWord; w <= lastWord; ++w) {
+                int valid = min(64, lvl.occupancy.size() - w * 64);
+                uint64_t validMask = (valid == 64) ? ~uint64_t(0) : ((uint64_t(1) << valid) - 1);
+                uint64_t diff = (previous[w] ^ words[w]) & validMask;
+                while (diff) {
+                    int bit = lowestSetBit(diff);
+                    bool occupied = (words[w] >> bit) & 1;
+                    // Changed bits that all turned to the same state, from bit upward.
+                    uint64_t same = (diff & (occupied ? words[w] : ~words[w])) >> bit;
+                    int length = (~same == 0) ? 64 - bit : lowestSetBit(~same);
+                    int slot = w * 64 + bit;
+                    if (pending.length && pending.occupied == occupied &&
+                        pending.first + pending.length == slot) {
+                        pending.length += length;
+                    } else {
+                        emit(lvl.levelIndex, pending, mode, out);
+                        pending = Segment{slot, length, occupied};
+                    }
+                    diff &= (length + bit >= 64) ? 0 : (~uint64_t(0) << (bit + length));
+                }
+                previous[w] = words[w];
+            }
+            emit(lvl.levelIndex, pending, mode, out);
+        }
+        if (mode == DashboardMode::Terminal) {
+            out += "\x1b[" + to_string(bottomRow) + ";1H";  // Park the cursor below the grid
+        }
+        return segments;
+    }
+
+private:
+    struct Segment {
+        int first;
+        int length;
+        bool occupied;
+        Segment() : first(0), length(0), occupied(false) {}
+        Segment(int f, int len, bool occ) : first(f), length(len), occupied(occ) {}
+    };
+
+    bool started;
+    DashboardMode lastMode;              // Mode of the last frame
+    int segments;
+    int bottomRow;
+    vector<vector<uint64_t>> lastFrame;  // Occupancy words as last drawn
+    vector<int> levelRow;                // Terminal row of each level's header
+
+    // First frame: pretend everything changed so the whole garage is drawn.
+    void start(vector<Level>& levels, DashboardMode mode, string& out) {
+        started = true;
+        lastMode = mode;
+        lastFrame.assign(levels.size(), vector<uint64_t>());
+        levelRow.assign(levels.size(), 0);
+        int row = 1;
+        if (mode == DashboardMode::Terminal) out += "\x1b[2J\x1b[H";
+        for (auto& lvl : levels) {
+            Span<const uint64_t> words = lvl.occupancy.rawWords();
+            lastFrame[lvl.levelIndex].resize(words.size());
+            for (size_t w = 0; w < words.size(); ++w) lastFrame[lvl.levelIndex][w] = ~words[w];
+            levelRow[lvl.levelIndex] = row;
+            if (mode == DashboardMode::Terminal) {
+                out += "\x1b[" + to_string(row) + ";1HLevel " + to_string(lvl.levelIndex);
+            }
+            row += 1 + (lvl.occupancy.size() + kDashboardColumns - 1) / kDashboardColumns;
+        }
+        bottomRow = row;
+    }
+
+    void emit(int level, const Segment& seg, DashboardMode mode, string& out) {
+        if (!seg.length) return;
+        segments++;
+        if (mode == DashboardMode::DiffRecords) {
+            out += "L" + to_string(level) + " " + to_string(seg.first) + "-" +
+                   to_string(seg.first + seg.length - 1) +
+                   (seg.occupied ? " occupied\n" : " free\n");
+            return;
+        }
+        const char* cell = seg.occupied ? "\u25A0" : "\u25A1";
+        for (int slot = seg.first; slot < seg.first + seg.length; ) {
+            int column = slot % kDashboardColumns;
+            int row = levelRow[level] + 1 + slot / kDashboardColumns;
+            int stretch = min(seg.first + seg.length - slot, kDashboardColumns - column);
+            out += "\x1b[" + to_string(row) + ";" + to_string(column + 1) + "H";
+            for (int i = 0; i < stretch; ++i) out += cell;
+            slot += stretch;
+        }
+    }
+};
+
+///////////////////////////////////////////////////////////
+// DemandForecaster: Expected arrivals of each machine kind for every
+// 15-minute bucket of the day, by exponential smoothing. Arrivals are
+// counted into the bucket in progress; when the clock moves on, that
+// count is folded into the bucket's forecast as
+//     forecast = alpha * count + (1 - alpha) * forecast
+// so each day's pattern refines the next. Recording an arrival and
+// reading a forecast are both O(1).
+///////////////////////////////////////////////////////////
+const int kForecastBucketMinutes = 15;
+const int kForecastBuckets = 24 * 60 / kForecastBucketMinutes;
+const double kForecastAlpha = 0.3;
+const double kTruckDemandThreshold = 0.5;  // Expected trucks per bucket that make pairs worth keeping
+
+class DemandForecaster {
+public:
+    explicit DemandForecaster(double smoothing = kForecastAlpha)
+        : alpha(smoothing), currentBucket(-1), arrivals{}, forecast{} {}
+
+    void recordArrival(MachineKind kind, long long minute) {
+        advanceTo(minute);
+        arrivals[int(kind)]++;
+    }
+
+    // Smoothed arrivals expected in the bucket that holds minute.
+    double expected(MachineKind kind, long long minute) const {
+        return forecast[bucketOfDay(minute)][int(kind)];
+    }
+
+    // Fold finished buckets into the forecast. Each bucket passed costs
+    // one fold, capped at a day's worth after a long idle gap.
+    void advanceTo(long long minute) {
+        long long bucket = minute / kForecastBucketMinutes;
+        if (currentBucket < 0) currentBucket = bucket;
+        long long steps = min<long long>(bucket - currentBucket, kForecastBuckets);
+        for (long long i = 0; i < steps; ++i) {
+            double* f = forecast[bucketIndex(currentBucket + i)];
+            for (int k = 0; k < 3; ++k) {
+                f[k] = alpha * arrivals[k] + (1 - alpha) * f[k];
+                arrivals[k] = 0;
+            }
+        }
+        if (bucket > currentBucket) currentBucket = bucket;
+    }
+
+    static int bucketOfDay(long long minute) {
+        return bucketIndex(minute / kForecastBucketMinutes);
+    }
+
+    // State as plain fields, for the handoff image. arrivalCounts has one
+    // entry per kind; forecastTable has kForecastBuckets rows of them.
+    double smoothing() const { return alpha; }
+    long long bucketInProgress() const { return currentBucket; }
+    const long long* arrivalCounts() const { return arrivals; }
+    const double* forecastTable() const { return &forecast[0][0]; }
+
+    void restore(double smoothing, long long bucket, const vector<long long>& counts,
+                 const vector<double>& table) {
+        alpha = smoothing;
+        currentBucket = bucket;
+        copy(counts.begin(), counts.end(), arrivals);
+        copy(table.begin(), table.end(), &forecast[0][0]);
+    }
+
+private:
+    // Bucket of the day for an absolute bucket; never negative.
+    static int bucketIndex(long long bucket) {
+        return int((bucket % kForecastBuckets + kForecastBuckets) % kForecastBuckets);
+    }
+
+    double alpha;
+    long long currentBucket;                 // Absolute bucket being counted
+    long long arrivals[3];                   // Arrivals so far in currentBucket, per kind
+    double forecast[kForecastBuckets][3];    // Smoothed arrivals per bucket of the day, per kind
+};
+
+///////////////////////////////////////////////////////////
+// TrafficCounters: Entries and exits per level per minute, for the last
+// kTrafficMinutes minutes. Every thread that parks or unparks counts
+// into its own shard, so no two cores write the same counters; a read
+// adds the shards up. Callers serialize access (the garage lock), so
+// the counters themselves are plain integers.
+///////////////////////////////////////////////////////////
+const int kTrafficMinutes = 60;
+static atomic<uint64_t> nextTrafficCountersId(1);
+
+class TrafficCounters {
+public:
+    explicit TrafficCounters(int levelCount = 0) : levels(levelCount), id(nextTrafficCountersId++) {}
+
+    void record(int level, long long minute, bool entry) {
+        Shard& shard = localShard();
+        int slot = slotOf(minute);
+        if (shard.stamp[slot] != minute) {
+            // First count of this minute here; the slot last held an older one.
+            shard.stamp[slot] = minute;
+            fill(shard.counts.begin() + slot * levels * 2, shard.counts.begin() + (slot + 1) * levels * 2, 0);
+        }
+        shard.counts[(slot * levels + level) * 2 + (entry ? 0 : 1)]++;
+    }
+
+    // Entries and exits on a level in one minute, summed over every thread.
+    void totals(int level, long long minute, long long& entries, long long& exits) const {
+        entries = exits = 0;
+        int slot = slotOf(minute);
+        for (const auto& shard : shards) {
+            if (shard->stamp[slot] != minute) continue;
+            entries += shard->counts[(slot * levels + level) * 2];
+            exits += shard->counts[(slot * levels + level) * 2 + 1];
+        }
+    }
+
+    size_t shardCount() const { return shards.size(); }
+
+private:
+    struct Shard {
+        thread::id owner;
+        long long stamp[kTrafficMinutes];  // Minute each slot counts, or -1
+        vector<uint32_t> counts;           // [slot][level][entries, exits]
+    };
+
+    int levels;
+    uint64_t id;  // Never reused, so a thread's cached shard can't go stale
+    vector<unique_ptr<Shard>> shards;
+
+    // Ring slot for a minute; never negative, even before the epoch.
+    static int slotOf(long long minute) {
+        return int((minute % kTrafficMinutes + kTrafficMinutes) % kTrafficMinutes);
+    }
+
+    // The calling thread's shard, found through a per-thread cache.
+    Shard& localShard() {
+        thread_local uint64_t cachedId = 0;
+        thread_local Shard* cached = nullptr;
+        if (cachedId == id) return *cached;
+        thread::id me = this_thread::get_id();
+        cached = nullptr;
+        for (auto& shard : shards) {
+            if (shard->owner == me) cached = shard.get();
+        }
+        if (!cached) {
+            shards.emplace_back(new Shard());
+            cached = shards.back().get();
+            cached->owner = me;
+            fill(cached->stamp, cached->stamp + kTrafficMinutes, -1);
+            cached->counts.assign(size_t(kTrafficMinutes) * levels * 2, 0);
+        }
+        cachedId = id;
+        return *cached;
+    }
+};
+
+///////////////////////////////////////////////////////////
+// MachineRecord: Everything the garage knows about one machine,
+// stored in a vector indexed by the machine's IdTable handle.
+///////////////////////////////////////////////////////////
+struct MachineRecord {
+    MachineKind kind = MachineKind::Car;
+    int level = -1;       // Level it is on, or -1 when not in the garage
+    int firstSlot = -1;   // A truck also holds firstSlot + 1
+    bool pending = false; // Space reserved, machine not arrived yet
+    int lastLevel = -1;   // Level used on its previous visit, if remembered
+    uint32_t waitTicket = 0;  // Its entry in the waitlist, 0 when not waiting
+    long long enteredMinute = 0;    // When its current stay began (garage clock)
+    uint32_t prevStay = kNoHandle;  // Neighbours in the arrival-ordered list of
+    uint32_t nextStay = kNoHandle;  // parked machines (reservations join on arrival)
+};
+
+///////////////////////////////////////////////////////////
+// DepartureCache: Keeps recently departed machines (e.g. monthly pass
+// holders who come and go all day) interned, so their record, including
+// the level they last used, survives until they come back. It is a
+// fixed ring of handles that each hold one IdTable reference; once
+// full, the oldest departure is pushed out.
+///////////////////////////////////////////////////////////
+const size_t kDepartureCacheSize = 1024;
+
+class DepartureCache {
+public:
+    explicit DepartureCache(size_t capacity) : ring(capacity, kNoHandle), nextSlot(0) {}
+
+    // Note a departure. Returns the handle pushed out (its reference now
+    // belongs to the caller), or kNoHandle.
+    uint32_t remember(uint32_t handle) {
+        uint32_t evicted = ring[nextSlot];
+        ring[nextSlot] = handle;
+        nextSlot = (nextSlot + 1) % ring.size();
+        return evicted;
+    }
+
+private:
+    vector<uint32_t> ring;
+    size_t nextSlot;
+};
+
+///////////////////////////////////////////////////////////
+// Waitlist: Machines turned away by a full garage, one FIFO per kind.
+// Each entry holds an IdTable reference and a ticket; the machine's
+// record carries the same ticket while it still waits. Leaving the line
+// (or parking some other way) only clears the record's ticket, and the
+// stale entry is dropped once it reaches the front, or sooner if stale
+// entries come to outnumber the machines still waiting.
+///////////////////////////////////////////////////////////
+const size_t kWaitlistLimit = 64;  // Machines waiting per kind
+
+struct WaitEntry {
+    uint32_t handle;
+    uint32_t ticket;
+};
+
+class Waitlist {
+public:
+    Waitlist() : nextTicket(1), waiting{} {}
+
+    uint32_t add(MachineKind kind, uint32_t handle) {
+        uint32_t ticket = nextTicket++;
+        if (nextTicket == 0) nextTicket = 1;  // 0 means not waiting
+        queues[int(kind)].push_back({handle, ticket});
+        waiting[int(kind)]++;
+        return ticket;
+    }
+
+    // A machine of this kind stopped waiting.
+    void removed(MachineKind kind) { waiting[int(kind)]--; }
+
+    size_t count(MachineKind kind) const { return waiting[int(kind)]; }
+    deque<WaitEntry>& queue(MachineKind kind) { return queues[int(kind)]; }
+    bool empty() const { return queues[0].empty() && queues[1].empty() && queues[2].empty(); }
+
+    // Whether ticket a was handed out before b, allowing for wraparound.
+    static bool earlier(uint32_t a, uint32_t b) { return int32_t(a - b) < 0; }
+
+private:
+    deque<WaitEntry> queues[3];
+    uint32_t nextTicket;
+    size_t waiting[3];  // Entries per kind still waiting
+};
+
+///////////////////////////////////////////////////////////
+// Snapshot format: A versioned binary image of the whole garage, so
+// state can move between environments without replaying commands.
+//
+//   header     magic "PKGSNAP", version, level count, machine count
+//   ID table   per machine: kind, flags, minute its stay began (since
+//              version 2), plate length, plate bytes; parked machines
+//              come first, in arrival order
+//   per level  slot count, bays per slot, occupancy words,
+//              one handle per occupied slot (in bit order),
+//              then every bay of every bike-zone slot
+//
+// Handles index the ID table; kNoHandle marks an empty bay. Integers are
+// written in host byte order.
+///////////////////////////////////////////////////////////
+const char kSnapshotMagic[8] = {'P', 'K', 'G', 'S', 'N', 'A', 'P', 0};
+const uint32_t kSnapshotVersion = 2;
+const uint32_t kBikeZoneHandle = 0xFFFFFFFEu;  // Slot holds bike bays
+const uint8_t kSnapshotPendingFlag = 1;        // Reserved, not yet arrived
+const size_t kMaxPlateLength = 255;            // Longest plate let in; must fit the 16-bit length
+
+template <typename T>
+static void writePod(ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool readPod(istream& in, T& value) {
+    return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+// Works for a vector or a Span.
+template <typename Array>
+static void writeArray(ostream& out, const Array& values) {
+    if (values.size()) out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(values[0]));
+}
+
+// Bytes between the read position and the end of the stream, or
+// UINT64_MAX if the stream can't seek to find out.
+static uint64_t bytesLeft(istream& in) {
+    streampos here = in.tellg();
+    if (here < 0) return UINT64_MAX;
+    in.seekg(0, ios::end);
+    streampos end = in.tellg();
+    in.seekg(here);
+    return end < here ? 0 : uint64_t(end - here);
+}
+
+// A count read from a file is only trusted as far as the file has bytes
+// to back it, so a corrupt count can't make us allocate wildly.
+template <typename T>
+static bool readArray(istream& in, vector<T>& values, size_t count) {
+    if (count > bytesLeft(in) / sizeof(T)) return false;
+    values.resize(count);
+    return count == 0 || bool(in.read(reinterpret_cast<char*>(values.data()), count * sizeof(T)));
+}
+
+///////////////////////////////////////////////////////////
+// OperationLog: A write-ahead log of every change to the garage, split
+// into numbered segment files. Records are delta encoded to stay small:
+//
+//   op|kind byte, plate as (shared prefix with previous plate, suffix),
+//   for placements the level plus the first slot as a zigzag delta from
+//   the previous placement (a truck's second slot is implied), and for
+//   Store and Commit (since version 2) the minute the stay began as a
+//   zigzag delta from the previous such minute.
+//
+// Each segment starts with fresh delta state so it decodes on its own.
+// A record is written and fdatasync'd before the operation returns, so
+// a crash loses nothing that was acknowledged. If a write or a new
+// segment fails, the log stops taking records and says why; the caller
+// must report that the change was not logged.
+// snapshot-<n>.snap holds the state just before segment n, so recovery
+// loads the newest snapshot and replays the segments from n onward.
+///////////////////////////////////////////////////////////
+enum class WalOp : uint8_t {
+    Store = 1,    // Parked in the given slots
+    Reserve = 2,  // Space held for an expected arrival
+    Commit = 3,   // Reserved machine arrived
+    Unpark = 4,   // Machine left
+    Cancel = 5    // Reservation dropped
+};
+
+const char kWalMagic[8] = {'P', 'K', 'G', 'W', 'A', 'L', 0, 0};
+const uint32_t kWalVersion = 2;
+const size_t kWalSegmentBytes = 4 << 20;      // Roll to a new segment past this size
+const uint64_t kWalCompactAfterSegments = 4;  // Sealed segments that trigger compaction
+const chrono::seconds kWalCompactRetry(5);     // Wait after a failed compaction
+
+static void putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += char(value | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+static bool getVarint(const string& in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        uint8_t byte = uint8_t(in[pos++]);
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static uint64_t zigzag(int64_t value) { return (uint64_t(value) << 1) ^ uint64_t(value >> 63); }
+static int64_t unzigzag(uint64_t value) { return int64_t(value >> 1) ^ -int64_t(value & 1); }
+
+// Whether a record starts a stay, and so carries its entry minute.
+static bool startsStay(WalOp op) { return op == WalOp::Store || op == WalOp::Commit; }
+
+// One decoded log record.
+struct WalRecord {
+    WalOp op;
+    MachineKind kind;
+    string plate;
+    int level;
+    int firstSlot;
+    bool hasMinute;           // False for version 1 segments
+    long long enteredMinute;  // Start of the stay, if hasMinute
+};
+
+// Decodes the records of one segment in order.
+class WalReader {
+public:
+    explicit WalReader(const string& segmentBytes)
+        : bytes(segmentBytes), pos(0), wholeBytes(0), version(0), prevSlot(0), prevMinute(0) {}
+
+    bool validHeader() {
+        if (bytes.size() < sizeof(kWalMagic) + sizeof(version) ||
+            !equal(kWalMagic, kWalMagic + 8, bytes.begin())) {
+            return false;
+        }
+        memcpy(&version, bytes.data() + sizeof(kWalMagic), sizeof(version));
+        pos = wholeBytes = sizeof(kWalMagic) + sizeof(version);
+        return version >= 1 && version <= kWalVersion;
+    }
+
+    // Bytes up to the end of the last record decoded, and whether that
+    // is the whole segment (false after a torn tail).
+    size_t validBytes() const { return wholeBytes; }
+    bool complete() const { return wholeBytes == bytes.size(); }
+
+    // Next record; false at the end or at a torn tail.
+    bool next(WalRecord& rec) {
+        if (pos >= bytes.size()) return false;
+        uint8_t head = uint8_t(bytes[pos++]);
+        rec.op = WalOp(head & 0x0F);
+        rec.kind = MachineKind(head >> 4);
+        uint64_t shared, suffix;
+        if (!getVarint(bytes, pos, shared) || !getVarint(bytes, pos, suffix) ||
+            shared > prevPlate.size() || pos + suffix > bytes.size()) {
+            return false;
+        }
+        prevPlate.resize(shared);
+        prevPlate.append(bytes, pos, suffix);
+        rec.plate = prevPlate;
+        pos += suffix;
+        if (rec.op == WalOp::Store || rec.op == WalOp::Reserve) {
+            uint64_t level, delta;
+            if (!getVarint(bytes, pos, level) || !getVarint(bytes, pos, delta)) return false;
+            rec.level = int(level);
+            prevSlot += unzigzag(delta);
+            rec.firstSlot = int(prevSlot);
+        }
+        rec.hasMinute = version >= 2 && startsStay(rec.op);
+        if (rec.hasMinute) {
+            uint64_t delta;
+            if (!getVarint(bytes, pos, delta)) return false;
+            prevMinute += unzigzag(delta);
+            rec.enteredMinute = prevMinute;
+        }
+        wholeBytes = pos;
+        return true;
+    }
+
+private:
+    const string& bytes;
+    size_t pos;
+    size_t wholeBytes;
+    uint32_t version;
+    string prevPlate;
+    int64_t prevSlot;
+    int64_t prevMinute;
+};
+
+// fsync a file or directory by path, so a rename or new file survives
+// a crash.
+static bool syncPath(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+// Write data to path through a temporary file that is synced and renamed
+// into place, so path either appears whole and durable or not at all.
+static bool writeFileDurably(const string& path, const string& data, const string& dir) {
+    string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = true;
+    for (size_t done = 0; ok && done < data.size();) {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        ok = n > 0;
+        if (ok) done += size_t(n);
+    }
+    ok = fsync(fd) == 0 && ok;
+    ok = ::close(fd) == 0 && ok;
+    ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) remove(tmp.c_str());
+    return ok && syncPath(dir);
+}
+
+class OperationLog {
+public:
+    OperationLog()
+        : fd(-1), active(0), oldest(0), activeBytes(0), recordStart(0), prevSlot(0), prevMinute(0), opsLogged(0),
+          bytesLogged(0), writeSeconds(0.0), compactions(0) {}
+
+    ~OperationLog() { close(); }
+
+    // Start writing at segment number `segment` in directory dir. Files
+    // from oldestKept onward are left for the next compaction to retire.
+    bool open(const string& dir, uint64_t segment, uint64_t oldestKept) {
+        directory = dir;
+        oldest = oldestKept;
+        active = segment;
+        return startSegment();
+    }
+
+    void close() {
+        if (fd >= 0) {
+            flush();
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // Append a record and wait for it to reach the disk. False if it
+    // didn't (see failure()).
+    // enteredMinute is only written for records that start a stay.
+    bool logPlacement(WalOp op, const Machine& machine, int level, const vector<int>& slots,
+                      long long enteredMinute) {
+        if (failed()) return false;
+        beginRecord(op, machine.kind, machine.identifier);
+        putVarint(buffer, uint64_t(level));
+        putVarint(buffer, zigzag(int64_t(slots[0]) - prevSlot));
+        prevSlot = slots[0];
+        putMinute(op, enteredMinute);
+        return finishRecord();
+    }
+
+    bool logPlate(WalOp op, MachineKind kind, const string& plate, long long enteredMinute) {
+        if (failed()) return false;
+        beginRecord(op, kind, plate);
+        putMinute(op, enteredMinute);
+        return finishRecord();
+    }
+
+    // Seal the active segment and open the next one. Returns its number;
+    // check failed() for whether it opened.
+    uint64_t roll() {
+        close();
+        active++;
+        startSegment();
+        return active;
+    }
+
+    // Stop taking records; everything logged so far stays recoverable.
+    void fail(const string& reason) {
+        if (failure.empty()) failure = reason;
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        buffer.clear();
+    }
+
+    bool failed() const { return !failure.empty(); }
+    const string& failureReason() const { return failure; }
+
+    // Delete segments and snapshots made obsolete by snapshot-<segment>.
+    // Runs on the compactor thread; only touches files older than segment.
+    void dropBefore(uint64_t segment) {
+        for (uint64_t n = oldest; n < segment; ++n) {
+            remove(segmentPath(directory, n).c_str());
+            remove(snapshotPath(directory, n).c_str());
+        }
+        if (segment > oldest) oldest = segment;
+        compactions++;
+    }
+
+    // Write what's buffered and wait for it to reach the disk.
+    bool flush() {
+        if (failed()) return false;
+        if (buffer.empty()) return true;
+        auto start = chrono::steady_clock::now();
+        bool ok = fd >= 0;
+        for (size_t done = 0; ok && done < buffer.size();) {
+            ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            ok = n > 0;
+            if (ok) done += size_t(n);
+        }
+        ok = ok && fdatasync(fd) == 0;
+        writeSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        buffer.clear();
+        if (!ok) fail("cannot write " + segmentPath(directory, active) + ": " + strerror(errno));
+        return ok;
+    }
+
+    uint64_t sealedSegments() const { return active - oldest; }
+    uint64_t activeSegment() const { return active; }
+    uint64_t oldestSegment() const { return oldest; }
+    const string& dir() const { return directory; }
+    long long operations() const { return opsLogged; }
+    long long bytes() const { return bytesLogged; }
+    double secondsWriting() const { return writeSeconds; }
+    long long compactionCount() const { return compactions; }
+
+    static string segmentPath(const string& dir, uint64_t n) {
+        return dir + "/wal-" + to_string(n) + ".log";
+    }
+
+    static string snapshotPath(const string& dir, uint64_t n) {
+        return dir + "/snapshot-" + to_string(n) + ".snap";
+    }
+
+private:
+    string directory;
+    int fd;                      // Active segment
+    string buffer;               // Encoded records not yet written
+    uint64_t active;             // Segment being appended to
+    atomic<uint64_t> oldest;     // Oldest segment still on disk
+    size_t activeBytes;
+    size_t recordStart;          // Where the record being encoded begins
+    string prevPlate;            // Delta state, reset per segment
+    int64_t prevSlot;
+    int64_t prevMinute;
+    long long opsLogged;
+    long long bytesLogged;
+    double writeSeconds;
+    atomic<long long> compactions;
+    string failure;              // Why the log stopped, or empty
+
+    bool startSegment() {
+        if (failed()) return false;
+        fd = ::open(segmentPath(directory, active).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            fail("cannot create " + segmentPath(directory, active) + ": " + strerror(errno));
+            return false;
+        }
+        buffer.assign(kWalMagic, sizeof(kWalMagic));
+        buffer.append(reinterpret_cast<const char*>(&kWalVersion), sizeof(kWalVersion));
+        activeBytes = buffer.size();
+        bytesLogged += buffer.size();
+        prevPlate.clear();
+        prevSlot = 0;
+        prevMinute = 0;
+        if (!flush()) return false;
+        if (!syncPath(directory)) {
+            fail("cannot sync " + directory);
+            return false;
+        }
+        return true;
+    }
+
+    void beginRecord(WalOp op, MachineKind kind, const string& plate) {
+        recordStart = buffer.size();
+        buffer += char(uint8_t(op) | (uint8_t(kind) << 4));
+        size_t shared = 0;
+        while (shared < plate.size() && shared < prevPlate.size() && plate[shared] == prevPlate[shared]) {
+            shared++;
+        }
+        putVarint(buffer, shared);
+        putVarint(buffer, plate.size() - shared);
+        buffer.append(plate, shared, string::npos);
+        prevPlate = plate;
+    }
+
+    void putMinute(WalOp op, long long enteredMinute) {
+        if (!startsStay(op)) return;
+        putVarint(buffer, zigzag(int64_t(enteredMinute) - prevMinute));
+        prevMinute = enteredMinute;
+    }
+
+    // The record is durable once flush succeeds; a failed roll after it
+    // only stops the records that follow.
+    bool finishRecord() {
+        size_t recordBytes = buffer.size() - recordStart;
+        if (!flush()) return false;
+        opsLogged++;
+        bytesLogged += recordBytes;
+        activeBytes += recordBytes;
+        if (activeBytes >= kWalSegmentBytes) roll();
+        return true;
+    }
+};
+
+// Find the newest snapshot and segment numbers in a log directory
+// (-1 when there are none). Returns false if the directory can't be read.
+static bool scanLogDirectory(const string& dir, long long& newestSnapshot, long long& newestSegment) {
+    newestSnapshot = -1;
+    newestSegment = -1;
+    DIR* handle = opendir(dir.c_str());
+    if (!handle) return false;
+    while (dirent* entry = readdir(handle)) {
+        unsigned long long n;
+        char tail[8];
+        if (sscanf(entry->d_name, "snapshot-%llu.%7s", &n, tail) == 2 && string(tail) == "snap") {
+            newestSnapshot = max(newestSnapshot, (long long)n);
+        } else if (sscanf(entry->d_name, "wal-%llu.%7s", &n, tail) == 2 && string(tail) == "log") {
+            newestSegment = max(newestSegment, (long long)n);
+        }
+    }
+    closedir(handle);
+    return true;
+}
+
+///////////////////////////////////////////////////////////
+// GarageConfig: Everything needed to build a Garage, so it can start
+// from a file instead of prompts. The file is read in one pass:
+//     # Two half-size basements, then three full decks.
+//     level 2048 count=2 bays=4
+//     level 4096 count=3
+//     truck_threshold 0.5
+//     forecast_alpha 0.3
+//     departure_cache 1024
+//     waitlist 64
+//     log garage-log
+// Levels are listed bottom first. With log set, startup recovers from
+// that log if it exists (its snapshot then decides the geometry) and
+// starts a new one there otherwise.
+///////////////////////////////////////////////////////////
+struct GarageConfig {
+    vector<int> slotCounts;
+    vector<int> bikeBays;                // Bays per bike slot, per level
+    double truckDemandThreshold = kTruckDemandThreshold;
+    double forecastAlpha = kForecastAlpha;
+    size_t departureCacheSize = kDepartureCacheSize;
+    size_t waitlistLimit = kWaitlistLimit;  // Per kind; 0 turns drivers away
+    string logDir;
+};
+
+// Largest value accepted for sizes and counts in a config file.
+const long long kMaxConfigValue = 1 << 24;
+const double kMaxTruckDemandThreshold = 1e6;
+
+// Parse all of token as an integer in [lo, hi]; "2x", "-1" for a count,
+// or an out-of-range value are errors rather than a best guess.
+static bool parseWholeInt(const string& token, long long lo, long long hi, long long& value) {
+    if (token.empty() || isspace(static_cast<unsigned char>(token[0]))) return false;
+    char* end;
+    errno = 0;
+    value = strtoll(token.c_str(), &end, 10);
+    return errno == 0 && *end == '\0' && value >= lo && value <= hi;
+}
+
+static bool parseWholeReal(const string& token, double lo, double hi, double& value) {
+    if (token.empty() || isspace(static_cast<unsigned char>(token[0]))) return false;
+    char* end;
+    errno = 0;
+    value = strtod(token.c_str(), &end);
+    return errno == 0 && *end == '\0' && value >= lo && value <= hi;  // Also rejects NaN
+}
+
+static bool loadGarageConfig(const string& path, GarageConfig& config, string& error) {
+    ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    string line;
+    long long totalSlots = 0;
+    for (int lineNo = 1; getline(in, line); ++lineNo) {
+        istringstream fields(line);
+        string key, value;
+        if (!(fields >> key) || key[0] == '#') continue;
+        fields >> value;  // Left empty if missing, which no parser accepts
+        bool ok = true;
+        long long number = 0;
+        if (key == "level") {
+            long long slots = 0, count = 1, bays = kBikeBaysPerSlot;
+            ok = parseWholeInt(value, 1, kMaxConfigValue, slots);
+            string setting;
+            while (ok && fields >> setting) {
+                if (setting.compare(0, 6, "count=") == 0) {
+                    ok = parseWholeInt(setting.substr(6), 1, kMaxConfigValue, count);
+                } else if (setting.compare(0, 5, "bays=") == 0) {
+                    ok = parseWholeInt(setting.substr(5), 1, kMaxBikeBaysPerSlot, bays);
+                } else {
+                    ok = false;
+                }
+            }
+            totalSlots += slots * count;
+            if (ok && totalSlots > kMaxConfigValue * 64) {
+                error = path + ":" + to_string(lineNo) + ": too many slots in total";
+                return false;
+            }
+            if (ok) {
+                config.slotCounts.insert(config.slotCounts.end(), size_t(count), int(slots));
+                config.bikeBays.insert(config.bikeBays.end(), size_t(count), int(bays));
+            }
+        } else if (key == "truck_threshold") {
+            ok = parseWholeReal(value, 0, kMaxTruckDemandThreshold, config.truckDemandThreshold);
+        } else if (key == "forecast_alpha") {
+            ok = parseWholeReal(value, 0, 1, config.forecastAlpha) && config.forecastAlpha > 0;
+        } else if (key == "departure_cache") {
+            ok = parseWholeInt(value, 1, kMaxConfigValue, number);
+            config.departureCacheSize = size_t(number);
+        } else if (key == "waitlist") {
+            ok = parseWholeInt(value, 0, kMaxConfigValue, number);
+            config.waitlistLimit = size_t(number);
+        } else if (key == "log") {
+            ok = !value.empty();
+            config.logDir = value;
+        } else {
+            ok = false;
+        }
+        string extra;
+        if (!ok || (key != "level" && fields >> extra)) {
+            error = path + ":" + to_string(lineNo) + ": cannot parse '" + line + "'";
+            return false;
+        }
+    }
+    if (config.slotCounts.empty()) {
+        error = path + " defines no levels";
+        return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////
+// Handoff image: What a running garage passes to the process that
+// replaces it on hot_restart, in an inherited memfd:
+//
+//   header     magic "PKGHOFF", version, time the handoff began
+//   policy     truck threshold, departure cache size, clock skew,
+//              forecaster state, waitlist limit (since version 2)
+//   forecaster smoothing, bucket in progress, then (since version 3)
+//              kind and bucket counts, arrivals per kind, and the
+//              forecast per bucket and kind
+//   log        directory (empty when not logging), segment to resume
+//              at, oldest segment still on disk
+//   snapshot   the usual snapshot image
+//   waitlist   (since version 2) count, then kind, plate length and
+//              plate of each waiting machine, longest wait first
+///////////////////////////////////////////////////////////
+const char kHandoffMagic[8] = {'P', 'K', 'G', 'H', 'O', 'F', 'F', 0};
+const uint32_t kHandoffVersion = 3;
+
+///////////////////////////////////////////////////////////
+// SensorFrame: One reading of every bay sensor, laid out like the
+// garage's own occupancy words (level after level, each level a whole
+// number of words, bit set = something is in the slot). On disk:
+//
+//   header     magic "PKGSENS", version, level count
+//   per level  slot count, occupancy words
+///////////////////////////////////////////////////////////
+const char kSensorMagic[8] = {'P', 'K', 'G', 'S', 'E', 'N', 'S', 0};
+const uint32_t kSensorVersion = 1;
+const int kSensorReportLimit = 20;  // Mismatches listed before "and N more"
+
+struct SensorFrame {
+    vector<int> slotCounts;
+    vector<uint64_t> words;
+};
+
+static void writeSensorFrame(ostream& out, const SensorFrame& frame) {
+    out.write(kSensorMagic, sizeof(kSensorMagic));
+    writePod(out, kSensorVersion);
+    writePod(out, uint32_t(frame.slotCounts.size()));
+    size_t offset = 0;
+    for (int n : frame.slotCounts) {
+        size_t wordCount = (n + 63) / 64;
+        writePod(out, uint32_t(n));
+        out.write(reinterpret_cast<const char*>(frame.words.data() + offset), wordCount * sizeof(uint64_t));
+        offset += wordCount;
+    }
+}
+
+static bool readSensorFrame(istream& in, SensorFrame& frame, string& error) {
+    char magic[8];
+    uint32_t version, levelCount;
+    if (!in.read(magic, sizeof(magic)) || !equal(magic, magic + 8, kSensorMagic)) {
+        error = "not a sensor frame";
+        return false;
+    }
+    if (!readPod(in, version) || version != kSensorVersion || !readPod(in, levelCount)) {
+        error = "unsupported sensor frame";
+        return false;
+    }
+    frame.slotCounts.clear();
+    frame.words.clear();
+    vector<uint64_t> words;
+    for (uint32_t l = 0; l < levelCount; ++l) {
+        uint32_t slotCount;
+        if (!readPod(in, slotCount) || !readArray(in, words, (slotCount + 63) / 64)) {
+            error = "truncated sensor frame at level " + to_string(l);
+            return false;
+        }
+        frame.slotCounts.push_back(int(slotCount));
+        frame.words.insert(frame.words.end(), words.begin(), words.end());
+    }
+    return true;
+}
+
+// Furthest advance_clock may move the garage clock: a century of minutes.
+const long long kMaxClockSkewMinutes = 100LL * 366 * 24 * 60;
+
+///////////////////////////////////////////////////////////
+// Garage: Oversees all levels and operations.
+///////////////////////////////////////////////////////////
+class Garage {
+private:
+    // A listing of levels, and the flat arrays behind their slots.
+    vector<Level> levels;
+    FlatLevelStore levelStore;
+
+    // Every plate the garage refers to, stored once. Slots, records and
+    // the departure cache all hold 32-bit handles into it.
+    IdTable ids;
+
+    // Type and location of each machine, indexed by handle. A record is
+    // live while its machine is parked or reserved (level >= 0).
+    ChunkedArray<MachineRecord> records;
+    size_t machinesInside;
+
+    // Ends of the list of parked machines in arrival order, so the
+    // longest stays are found without a scan.
+    uint32_t oldestStay;
+    uint32_t newestStay;
+
+    // We lock this for thread-safe operations.
+    mutable mutex garageMutex;
+
+    // Where operation messages go; the stress harness silences them.
+    ostream* console;
+
+    // Machines that left recently, so re-entries go back to their level.
+    DepartureCache recentDepartures;
+
+    // Entries and exits per level per minute.
+    TrafficCounters traffic;
+
+    // Machines turned away while full, parked as departures free space.
+    Waitlist waitlist;
+    size_t waitlistLimit;
+
+    // Arrivals per kind by time of day. When trucks are expected, cars
+    // and bikes fill lone gaps first so adjacent pairs stay open.
+    DemandForecaster forecaster;
+    double truckDemandThreshold;
+    size_t departureCacheSize;
+    long long utcOffsetSeconds;   // Local time zone, read once
+    long long clockSkewMinutes;   // Moved by advance_clock to replay a day
+
+    // Minutes since the epoch, local time.
+    long long nowMinute() const {
+        return (static_cast<long long>(time(nullptr)) + utcOffsetSeconds) / 60 + clockSkewMinutes;
+    }
+
+    bool keepPairsFor(const Machine& machine) const {
+        return machine.slotsNeeded() == 1 &&
+               forecaster.expected(MachineKind::Truck, nowMinute()) >= truckDemandThreshold;
+    }
+
+    // Handle of a machine currently parked or reserved, or kNoHandle.
+    uint32_t findInside(const string& machineId) const {
+        uint32_t h = ids.find(machineId);
+        return (h != kNoHandle && records[h].level >= 0) ? h : kNoHandle;
+    }
+
+    // Take a reference to a plate for a new stay, making room for its record.
+    uint32_t acquireHandle(const string& machineId) {
+        uint32_t h = ids.intern(machineId);
+        if (h >= records.size()) records.resize(h + 1);
+        return h;
+    }
+
+    // Drop a reference; a handle nobody holds any more gets a clean record.
+    void releaseHandle(uint32_t h) {
+        if (ids.release(h)) records[h] = MachineRecord();
+    }
+
+    static GarageConfig configFor(const vector<int>& slotCounts) {
+        GarageConfig config;
+        config.slotCounts = slotCounts;
+        return config;
+    }
+
+    // Where each level's words start in levelStore.allWords(), plus the end.
+    vector<size_t> levelWordStarts() const {
+        vector<size_t> starts(1, 0);
+        for (const auto& lvl : levels) starts.push_back(starts.back() + lvl.occupancy.rawWords().size());
+        return starts;
+    }
+
+    static vector<int> slotsOf(const MachineRecord& rec) {
+        if (rec.kind == MachineKind::Truck) return {rec.firstSlot, rec.firstSlot + 1};
+        return {rec.firstSlot};
+    }
+
+    // True when everything in an occupied slot is a reservation that
+    // hasn't arrived, so a sensor there should read empty. A bike-zone
+    // slot only qualifies if every bike in its bays is still pending.
+    bool onlyReservedAt(int level, int slot) const {
+        const Level& lvl = levels[level];
+        const Slot& s = lvl.slotList[slot];
+        if (!s.isOccupied) return false;
+        if (!s.isBikeZone) return records[s.occupant].pending;
+        for (int b = 0; b < lvl.bikePool.baysPerSlot; ++b) {
+            uint32_t bike = lvl.bikePool.bayOccupant(slot, b);
+            if (bike != kNoHandle && !records[bike].pending) return false;
+        }
+        return true;
+    }
+
+    // Reused by showMap so rendering doesn't allocate each time.
+    LevelMapRenderer mapRenderer;
+
+    // Remembers the last dashboard frame so the next one is a diff.
+    DashboardRenderer dashboard;
+    string dashboardBuffer;
+
+    // Write-ahead log, once enabled, and the thread that folds sealed
+    // segments into snapshots so the log on disk stays bounded.
+    unique_ptr<OperationLog> wal;
+    thread compactor;
+    condition_variable compactorWake;
+    bool stopCompactor;
+
+    void logPlacement(WalOp op, const Machine& machine, int level, const vector<int>& slots) {
+        if (!wal) return;
+        if (!wal->logPlacement(op, machine, level, slots, records[machine.handle].enteredMinute)) {
+            reportUnlogged(machine.identifier);
+        }
+        if (wal->sealedSegments() >= kWalCompactAfterSegments || wal->failed()) compactorWake.notify_one();
+    }
+
+    // enteredMinute matters only for Commit, which starts a stay.
+    void logPlate(WalOp op, MachineKind kind, const string& machineId, long long enteredMinute = 0) {
+        if (!wal) return;
+        if (!wal->logPlate(op, kind, machineId, enteredMinute)) reportUnlogged(machineId);
+        if (wal->sealedSegments() >= kWalCompactAfterSegments || wal->failed()) compactorWake.notify_one();
+    }
+
+    // The change already happened here but won't survive a restart; say so
+    // every time rather than let it pass as durable.
+    void reportUnlogged(const string& machineId) {
+        *console << "WARNING: the change for '" << machineId << "' was not logged ("
+                 << wal->failureReason() << "). Logging is off until wal_enable or wal_recover." << endl;
+    }
+
+    // Snapshot the current state, start a new segment and retire everything
+    // the snapshot covers. Serializes under the lock; the file I/O happens
+    // with the lock released. Older files are only dropped once the
+    // snapshot is durably in place, so a failed write costs nothing but
+    // disk space. Returns false if the snapshot was not written.
+    bool compactLog(unique_lock<mutex>& lock) {
+        ostringstream image;
+        writeSnapshot(image);
+        if (!wal->flush()) return false;
+        uint64_t base = wal->roll();
+        if (wal->failed()) return false;
+        OperationLog* log = wal.get();
+        lock.unlock();
+        string path = OperationLog::snapshotPath(log->dir(), base);
+        bool written = writeFileDurably(path, image.str(), log->dir()) && snapshotReadsBack(path);
+        if (written) log->dropBefore(base);
+        lock.lock();
+        return written;
+    }
+
+    // Read a snapshot back from disk before anything older is deleted. One
+    // that doesn't load is removed, so recovery falls back to the files
+    // it would have replaced.
+    static bool snapshotReadsBack(const string& path) {
+        ifstream in(path, ios::binary);
+        LoadedSnapshot check;
+        string error;
+        if (in && parseSnapshot(in, 0, check, error)) return true;
+        remove(path.c_str());
+        return false;
+    }
+
+    void runCompactor() {
+        unique_lock<mutex> lock(garageMutex);
+        while (true) {
+            compactorWake.wait(lock, [this]() {
+                return stopCompactor || wal->failed() || wal->sealedSegments() >= kWalCompactAfterSegments;
+            });
+            if (stopCompactor || wal->failed()) return;
+            if (!compactLog(lock) && !wal->failed()) {
+                *console << "WARNING: log compaction could not write a snapshot; keeping older segments"
+                         << " and retrying." << endl;
+                compactorWake.wait_for(lock, kWalCompactRetry, [this]() { return stopCompactor; });
+            }
+        }
+    }
+
+    // Drop a log that stopped after an error, so logging can start again.
+    void discardFailedLog() {
+        {
+            lock_guard<mutex> lock(garageMutex);
+            if (!wal || !wal->failed()) return;
+        }
+        stopCompactorThread();
+        lock_guard<mutex> lock(garageMutex);
+        wal.reset();
+    }
+
+    // Ask the compactor to finish and wait for it.
+    void stopCompactorThread() {
+        if (!compactor.joinable()) return;
+        {
+            lock_guard<mutex> lock(garageMutex);
+            stopCompactor = true;
+        }
+        compactorWake.notify_one();
+        compactor.join();
+        stopCompactor = false;
+    }
+
+    // Apply one logged operation without printing. Caller must hold garageMutex.
+    bool replayRecord(const WalRecord& rec, string& error) {
+        switch (rec.op) {
+            case WalOp::Store:
+            case WalOp::Reserve: {
+                Machine machine(rec.plate, rec.kind);
+                vector<int> slots = {rec.firstSlot};
+                if (machine.slotsNeeded() == 2) slots.push_back(rec.firstSlot + 1);
+                if (rec.level < 0 || rec.level >= int(levels.size()) || rec.firstSlot < 0 ||
+                    slots.back() >= int(levels[rec.level].slotList.size()) ||
+                    findInside(rec.plate) != kNoHandle) {
+                    error = "cannot replay placement of " + rec.plate;
+                    return false;
+                }
+                machine.handle = acquireHandle(rec.plate);
+                if (!levels[rec.level].assignMachine(machine, slots)) {
+                    releaseHandle(machine.handle);
+                    error = "cannot replay placement of " + rec.plate;
+                    return false;
+                }
+                recordPlacement(machine, rec.level, slots);
+                if (rec.op == WalOp::Reserve) holdForArrival(machine.handle);
+                else if (rec.hasMinute) records[machine.handle].enteredMinute = rec.enteredMinute;
+                return true;
+            }
+            case WalOp::Commit: {
+                uint32_t h = findInside(rec.plate);
+                if (h != kNoHandle && records[h].pending) {
+                    records[h].pending = false;
+                    beginStay(h);
+                    if (rec.hasMinute) records[h].enteredMinute = rec.enteredMinute;
+                }
+                return true;
+            }
+            case WalOp::Unpark:
+            case WalOp::Cancel:
+                if (findInside(rec.plate) == kNoHandle ||
+                    !releaseMachine(findInside(rec.plate), rec.op == WalOp::Unpark)) {
+                    error = "cannot replay removal of " + rec.plate;
+                    return false;
+                }
+                return true;
+        }
+        error = "unknown log record";
+        return false;
+    }
+
+    // Find space on the first level that fits and record the placement.
+    // A returning machine tries the level it used last time first.
+    // machine.handle must already be acquired. Caller must hold garageMutex.
+    bool placeMachine(const Machine& machine, int& whichLevel, vector<int>& slotIndices) {
+        int preferred = records[machine.handle].lastLevel;
+        bool keepPairs = keepPairsFor(machine);
+        if (preferred >= 0 && preferred < int(levels.size()) &&
+            tryLevel(levels[preferred], machine, keepPairs, slotIndices)) {
+            whichLevel = preferred;
+            return true;
+        }
+        for (auto& lvl : levels) {
+            if (lvl.levelIndex != preferred && tryLevel(lvl, machine, keepPairs, slotIndices)) {
+                whichLevel = lvl.levelIndex;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Place the machine on one level if it fits there.
+    bool tryLevel(Level& lvl, const Machine& machine, bool keepPairs, vector<int>& slotIndices) {
+        if (!lvl.hasRoomFor(machine)) return false;  // Skip hopeless levels cheaply
+        slotIndices = lvl.spotsAvailable(machine, keepPairs);
+        if (slotIndices.empty() || !lvl.assignMachine(machine, slotIndices)) return false;
+        recordPlacement(machine, lvl.levelIndex, slotIndices);
+        return true;
+    }
+
+    // Save where a machine now sits. A machine parked while waiting,
+    // however it got in, is no longer waiting.
+    void recordPlacement(const Machine& machine, int level, const vector<int>& slotIndices) {
+        MachineRecord& rec = records[machine.handle];
+        if (rec.waitTicket != 0) {
+            waitlist.removed(rec.kind);
+            rec.waitTicket = 0;
+        }
+        rec.kind = machine.kind;
+        rec.level = level;
+        rec.firstSlot = slotIndices[0];
+        rec.pending = false;
+        machinesInside++;
+        beginStay(machine.handle);
+    }
+
+    // Start a machine's stay and append it to the arrival-ordered list.
+    void beginStay(uint32_t h) {
+        MachineRecord& rec = records[h];
+        rec.enteredMinute = nowMinute();
+        rec.prevStay = newestStay;
+        rec.nextStay = kNoHandle;
+        if (newestStay != kNoHandle) {
+            records[newestStay].nextStay = h;
+        } else {
+            oldestStay = h;
+        }
+        newestStay = h;
+    }
+
+    // Take a machine out of the arrival-ordered list.
+    void endStay(uint32_t h) {
+        MachineRecord& rec = records[h];
+        if (rec.prevStay != kNoHandle) {
+            records[rec.prevStay].nextStay = rec.nextStay;
+        } else {
+            oldestStay = rec.nextStay;
+        }
+        if (rec.nextStay != kNoHandle) {
+            records[rec.nextStay].prevStay = rec.prevStay;
+        } else {
+            newestStay = rec.prevStay;
+        }
+        rec.prevStay = rec.nextStay = kNoHandle;
+    }
+
+    // A reserved machine's stay only starts when it arrives.
+    void holdForArrival(uint32_t h) {
+        endStay(h);
+        records[h].pending = true;
+    }
+
+    // Serialize every level and record. Caller must hold garageMutex.
+    void writeSnapshot(ostream& out) const {
+        out.write(kSnapshotMagic, sizeof(kSnapshotMagic));
+        writePod(out, kSnapshotVersion);
+        writePod(out, uint32_t(levels.size()));
+        writePod(out, uint32_t(machinesInside));
+
+        // Live handles are renumbered densely for the file: parked
+        // machines in arrival order, then reservations.
+        vector<uint32_t> handles(records.size(), kNoHandle);
+        uint32_t nextHandle = 0;
+        auto writeMachine = [&](uint32_t h) {
+            const MachineRecord& rec = records[h];
+            handles[h] = nextHandle++;
+            const string& plate = ids.name(h);
+            writePod(out, uint8_t(rec.kind));
+            writePod(out, uint8_t(rec.pending ? kSnapshotPendingFlag : 0));
+            writePod(out, int64_t(rec.enteredMinute));
+            writePod(out, uint16_t(plate.size()));
+            out.write(plate.data(), plate.size());
+        };
+        for (uint32_t h = oldestStay; h != kNoHandle; h = records[h].nextStay) writeMachine(h);
+        for (uint32_t h = 0; h < records.size(); ++h) {
+            if (records[h].level >= 0 && records[h].pending) writeMachine(h);
+        }
+
+        vector<uint32_t> occupants;
+        vector<uint32_t> bikeBays;
+        for (const auto& lvl : levels) {
+            Span<const uint64_t> words = lvl.occupancy.rawWords();
+            occupants.clear();
+            bikeBays.clear();
+            for (size_t w = 0; w < words.size(); ++w) {
+                for (uint64_t bits = words[w]; bits; bits &= bits - 1) {
+                    const Slot& s = lvl.slotList[w * 64 + lowestSetBit(bits)];
+                    if (!s.isBikeZone) {
+                        occupants.push_back(handles[s.occupant]);
+                        continue;
+                    }
+                    occupants.push_back(kBikeZoneHandle);
+                    for (int b = 0; b < lvl.bikePool.baysPerSlot; ++b) {
+                        uint32_t bike = lvl.bikePool.bayOccupant(s.slotIndex, b);
+                        bikeBays.push_back(bike == kNoHandle ? kNoHandle : handles[bike]);
+                    }
+                }
+            }
+            writePod(out, uint32_t(lvl.slotList.size()));
+            writePod(out, uint32_t(lvl.bikePool.baysPerSlot));
+            writeArray(out, words);
+            writeArray(out, occupants);
+            writeArray(out, bikeBays);
+        }
+    }
+
+    // Free a machine's slots and end its stay. Caller must hold garageMutex.
+    // A real departure (not a cancelled reservation) is remembered for re-entry.
+    bool releaseMachine(uint32_t h, bool departed = false) {
+        MachineRecord& rec = records[h];
+        if (!levels[rec.level].removeMachine(h, slotsOf(rec))) return false;
+        if (!rec.pending) endStay(h);
+        rec.lastLevel = departed ? rec.level : -1;
+        rec.level = -1;
+        rec.pending = false;
+        machinesInside--;
+        if (departed) {
+            ids.retain(h);
+            uint32_t evicted = recentDepartures.remember(h);
+            if (evicted != kNoHandle) releaseHandle(evicted);
+        }
+        releaseHandle(h);
+        return true;
+    }
+
+    void printStay(uint32_t h, long long now) const {
+        const MachineRecord& rec = records[h];
+        *console << "  " << ids.name(h) << " (" << kindToString(rec.kind) << ") on Level " << rec.level
+                 << ", parked " << formatMinutes(now - rec.enteredMinute) << endl;
+    }
+
+    // Drop entries at the front of a line whose machine no longer waits.
+    void trimWaitlist(deque<WaitEntry>& line) {
+        while (!line.empty() && records[line.front().handle].waitTicket != line.front().ticket) {
+            releaseHandle(line.front().handle);
+            line.pop_front();
+        }
+    }
+
+    // Drop stale entries from anywhere in a line once they outnumber the
+    // live ones, so join/leave churn can't grow it past twice the limit.
+    void compactWaitlist(MachineKind kind) {
+        deque<WaitEntry>& line = waitlist.queue(kind);
+        if (line.size() <= 2 * waitlist.count(kind)) return;
+        deque<WaitEntry> live;
+        for (const WaitEntry& e : line) {
+            if (records[e.handle].waitTicket == e.ticket) {
+                live.push_back(e);
+            } else {
+                releaseHandle(e.handle);
+            }
+        }
+        line.swap(live);
+    }
+
+    // Park waiting machines in space just freed on a level, longest wait
+    // first. Only the front of each line is looked at, and each pass
+    // either parks someone or stops, so a departure costs a constant
+    // amount of work per machine it lets in. A waiting truck is only let
+    // in once a pair is open.
+    void matchWaitlist(int level) {
+        Level& lvl = levels[level];
+        while (!waitlist.empty()) {
+            int bestKind = -1;
+            for (int k = 0; k < 3; ++k) {
+                deque<WaitEntry>& line = waitlist.queue(MachineKind(k));
+                trimWaitlist(line);
+                if (line.empty() || !lvl.hasRoomFor(Machine(string(), MachineKind(k)))) continue;
+                if (bestKind < 0 ||
+                    Waitlist::earlier(line.front().ticket, waitlist.queue(MachineKind(bestKind)).front().ticket)) {
+                    bestKind = k;
+                }
+            }
+            if (bestKind < 0) return;
+            deque<WaitEntry>& line = waitlist.queue(MachineKind(bestKind));
+            Machine waiter(ids.name(line.front().handle), MachineKind(bestKind));
+            waiter.handle = line.front().handle;
+            vector<int> slotIndices;
+            if (!tryLevel(lvl, waiter, keepPairsFor(waiter), slotIndices)) return;
+            line.pop_front();  // Its reference now belongs to the stay
+            traffic.record(level, records[waiter.handle].enteredMinute, true);
+            logPlacement(WalOp::Store, waiter, level, slotIndices);
+            *console << "Waitlisted machine '" << waiter.identifier << "' stored on Level " << level
+                     << " in slot(s): ";
+            for (int s : slotIndices) *console << s << " ";
+            *console << endl;
+        }
+    }
+
+    // Snapshots, the log and the handoff image store plates with a short
+    // length, so longer ones are turned away at the gate.
+    bool plateFits(const Machine& machine) {
+        if (machine.identifier.size() <= kMaxPlateLength) return true;
+        *console << "Machine ID is longer than " << kMaxPlateLength << " characters; not admitted." << endl;
+        return false;
+    }
+
+    // The forecaster goes field by field with explicit counts, so a new
+    // binary never has to share the old one's object layout.
+    void writeForecaster(ostream& out) const {
+        writePod(out, forecaster.smoothing());
+        writePod(out, forecaster.bucketInProgress());
+        writePod(out, uint32_t(3));
+        writePod(out, uint32_t(kForecastBuckets));
+        for (int k = 0; k < 3; ++k) writePod(out, int64_t(forecaster.arrivalCounts()[k]));
+        for (int i = 0; i < kForecastBuckets * 3; ++i) writePod(out, forecaster.forecastTable()[i]);
+    }
+
+    // Version 2 images held the forecaster's raw bytes, which were these
+    // same fields in this order with no counts.
+    bool readForecaster(istream& in, uint32_t version, string& error) {
+        double smoothing;
+        int64_t bucket;
+        uint32_t kinds = 3, buckets = kForecastBuckets;
+        if (!readPod(in, smoothing) || !readPod(in, bucket) ||
+            (version >= 3 && (!readPod(in, kinds) || !readPod(in, buckets)))) {
+            return false;
+        }
+        if (kinds != 3 || buckets != uint32_t(kForecastBuckets)) {
+            error = "forecaster has " + to_string(buckets) + " bucket(s) of " + to_string(kinds) +
+                    " kind(s); expected " + to_string(kForecastBuckets) + " of 3";
+            return false;
+        }
+        vector<long long> counts(3);
+        vector<double> table(size_t(kForecastBuckets) * 3);
+        for (auto& c : counts) {
+            int64_t n;
+            if (!readPod(in, n)) return false;
+            c = n;
+        }
+        for (auto& f : table) {
+            if (!readPod(in, f)) return false;
+        }
+        forecaster.restore(smoothing, bucket, counts, table);
+        return true;
+    }
+
+    // Note one slot of a snapshot machine's placement. Slots arrive in
+    // ascending order, so a truck's second slot must follow its first.
+    static bool claimSlot(MachineRecord& rec, uint8_t& held, int level, int slot) {
+        if (held == 0) {
+            rec.level = level;
+            rec.firstSlot = slot;
+        } else if (held > 1 || rec.level != level || slot != rec.firstSlot + 1) {
+            return false;
+        }
+        held++;
+        return true;
+    }
+
+    // A snapshot read into fresh containers, ready to swap in.
+    struct LoadedSnapshot {
+        IdTable ids;
+        ChunkedArray<MachineRecord> records;
+        uint32_t oldest = kNoHandle, newest = kNoHandle;
+        uint32_t machineCount = 0;
+        vector<Level> levels;
+        FlatLevelStore store;
+    };
+
+    // Read and check a whole snapshot. Version 1 files have no entry
+    // times, so those stays start at importMinute. Touches no garage
+    // state, so the compactor can use it to check what it wrote.
+    static bool parseSnapshot(istream& in, long long importMinute, LoadedSnapshot& snap, string& error) {
+        char magic[8];
+        uint32_t version, levelCount, machineCount;
+        if (!in.read(magic, sizeof(magic)) || !equal(magic, magic + 8, kSnapshotMagic)) {
+            error = "not a garage snapshot";
+            return false;
+        }
+        if (!readPod(in, version) || version == 0 || version > kSnapshotVersion) {
+            error = "unsupported snapshot version";
+            return false;
+        }
+        if (!readPod(in, levelCount) || !readPod(in, machineCount)) {
+            error = "truncated header";
+            return false;
+        }
+        // Every ID entry and every level takes some bytes, so counts the
+        // rest of the file can't hold are corrupt, not just large.
+        uint64_t remaining = bytesLeft(in);
+        uint64_t entryBytes = sizeof(uint8_t) * 2 + sizeof(uint16_t) + (version >= 2 ? sizeof(int64_t) : 0);
+        uint64_t levelBytes = sizeof(uint32_t) * 2;
+        if (levelCount == 0 || machineCount > remaining / entryBytes ||
+            levelCount > (remaining - machineCount * entryBytes) / levelBytes) {
+            error = "counts in header exceed the snapshot size";
+            return false;
+        }
+        snap.machineCount = machineCount;
+        // Containers grow as records are read; a stream that can't report
+        // its size may still claim more than memory holds.
+        try {
+            return readSnapshotBody(in, version, levelCount, machineCount, importMinute, snap, error);
+        } catch (const bad_alloc&) {
+            error = "snapshot too large to load";
+            return false;
+        }
+    }
+
+    // The ID table and levels of a snapshot, after its header. A fresh
+    // table hands out handles 0, 1, 2... so file handles can be used as
+    // table handles directly.
+    static bool readSnapshotBody(istream& in, uint32_t version, uint32_t levelCount, uint32_t machineCount,
+                                 long long importMinute, LoadedSnapshot& snap, string& error) {
+        // ID table. The header count is already bounded by the file size,
+        // so it is safe to size the table for it up front.
+        snap.ids.reserve(machineCount);
+        snap.records.reserve(machineCount);
+        string plate;
+        for (uint32_t h = 0; h < machineCount; ++h) {
+            uint8_t kind, flags;
+            uint16_t length;
+            int64_t entered = importMinute;
+            if (!readPod(in, kind) || !readPod(in, flags) || (version >= 2 && !readPod(in, entered)) ||
+                !readPod(in, length) || kind > 2) {
+                error = "corrupt ID table";
+                return false;
+            }
+            plate.resize(length);
+            if (length && !in.read(&plate[0], length)) {
+                error = "corrupt ID table";
+                return false;
+            }
+            if (snap.ids.intern(plate) != h) {
+                error = "duplicate plate in ID table";
+                return false;
+            }
+            snap.records.resize(h + 1);
+            snap.records[h].kind = MachineKind(kind);
+            snap.records[h].pending = (flags & kSnapshotPendingFlag) != 0;
+            snap.records[h].enteredMinute = entered;
+            if (snap.records[h].pending) continue;
+            // Parked machines come in arrival order.
+            snap.records[h].prevStay = snap.newest;
+            if (snap.newest != kNoHandle) {
+                snap.records[snap.newest].nextStay = h;
+            } else {
+                snap.oldest = h;
+            }
+            snap.newest = h;
+        }
+
+        // Levels, filling in each machine's placement as we go.
+        vector<uint8_t> slotsHeld(machineCount, 0);
+        vector<uint64_t> words;
+        vector<uint32_t> handles;
+        for (uint32_t l = 0; l < levelCount; ++l) {
+            uint32_t slotCount, bays;
+            if (!readPod(in, slotCount) || !readPod(in, bays) || slotCount == 0 || slotCount > uint32_t(INT32_MAX) ||
+                bays == 0 || bays > uint32_t(kMaxBikeBaysPerSlot) ||
+                !readArray(in, words, (slotCount + 63) / 64)) {
+                error = "corrupt level " + to_string(l);
+                return false;
+            }
+            snap.store.addLevel(snap.levels, int(slotCount), int(bays));
+            Level& lvl = snap.levels.back();
+            int occupied = 0;
+            for (uint64_t w : words) occupied += countBits(w);
+            if (!readArray(in, handles, occupied)) {
+                error = "truncated occupants on level " + to_string(l);
+                return false;
+            }
+            vector<int> bikeSlots;
+            size_t next = 0;
+            for (size_t w = 0; w < words.size(); ++w) {
+                for (uint64_t bits = words[w]; bits; bits &= bits - 1) {
+                    int idx = int(w * 64) + lowestSetBit(bits);
+                    uint32_t h = handles[next++];
+                    if (idx >= int(slotCount)) {
+                        error = "occupancy past the end of level " + to_string(l);
+                        return false;
+                    }
+                    if (h == kBikeZoneHandle) {
+                        bikeSlots.push_back(idx);
+                        continue;
+                    }
+                    if (h >= machineCount || !lvl.restoreSlot(idx, h) ||
+                        !claimSlot(snap.records[h], slotsHeld[h], int(l), idx)) {
+                        error = "bad occupant for slot " + to_string(idx) + " on level " + to_string(l);
+                        return false;
+                    }
+                }
+            }
+            if (!readArray(in, handles, bikeSlots.size() * bays)) {
+                error = "truncated bike bays on level " + to_string(l);
+                return false;
+            }
+            next = 0;
+            for (int idx : bikeSlots) {
+                for (uint32_t b = 0; b < bays; ++b) {
+                    uint32_t h = handles[next++];
+                    if (h == kNoHandle) continue;
+                    if (h >= machineCount || slotsHeld[h] != 0 ||
+                        !lvl.restoreBike(idx, int(b), h) ||
+                        !claimSlot(snap.records[h], slotsHeld[h], int(l), idx)) {
+                        error = "bad bike in slot " + to_string(idx) + " on level " + to_string(l);
+                        return false;
+                    }
+                }
+            }
+        }
+
+        for (uint32_t h = 0; h < machineCount; ++h) {
+            int needed = snap.records[h].kind == MachineKind::Truck ? 2 : 1;
+            if (slotsHeld[h] != needed) {
+                error = "machine " + snap.ids.name(h) + " has no valid placement";
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    // Construct a garage from a config (levels and policy settings).
+    explicit Garage(const GarageConfig& config)
+        : machinesInside(0), oldestStay(kNoHandle), newestStay(kNoHandle), console(&cout), recentDepartures(config.departureCacheSize),
+          waitlistLimit(config.waitlistLimit), forecaster(config.forecastAlpha),
+          truckDemandThreshold(config.truckDemandThreshold), departureCacheSize(config.departureCacheSize),
+          utcOffsetSeconds(0), clockSkewMinutes(0), stopCompactor(false) {
+        time_t now = time(nullptr);
+        tm local;
+        if (localtime_r(&now, &local)) utcOffsetSeconds = local.tm_gmtoff;
+        // Size everything once, then lay the levels out back to back.
+        levels.reserve(config.slotCounts.size());
+        levelStore.reserve(config.slotCounts);
+        for (size_t i = 0; i < config.slotCounts.size(); ++i) {
+            int bays = i < config.bikeBays.size() ? config.bikeBays[i] : kBikeBaysPerSlot;
+            levelStore.addLevel(levels, config.slotCounts[i], bays);
+        }
+        traffic = TrafficCounters(int(levels.size()));
+    }
+
+    // Construct a garage with the given number of slots on each level.
+    explicit Garage(const vector<int>& slotCounts) : Garage(configFor(slotCounts)) {}
+
+    // Every level the same size.
+    Garage(int totalLevels, int slotsEach) : Garage(vector<int>(totalLevels, slotsEach)) {}
+
+    ~Garage() { stopCompactorThread(); }
+
+    // Redirect operation messages (e.g. to a NullStream).
+    void setConsole(ostream& out) { console = &out; }
+
+    // Provide a helpful list of commands for the user.
+    void showAllCommands() {
+        cout << "\nHere are the commands you can use:" << endl;
+        cout << "  add_machine <id> <type>        (e.g. add_machine ABC123 Car)" << endl;
+        cout << "  unpark_machine <id>            (e.g. unpark_machine ABC123)" << endl;
+        cout << "  camera <in|out> <id> [type]    (Gate camera read, e.g. camera in ABC123 Car)" << endl;
+        cout << "  check_availability" << endl;
+        cout << "  check_full" << endl;
+        cout << "  show_map" << endl;
+        cout << "  dashboard <diff|ansi>          (Changes since the last frame)" << endl;
+        cout << "  forecast                       (Expected arrivals by kind)" << endl;
+        cout << "  metrics <minutes>              (Entries/exits per level, e.g. metrics 5)" << endl;
+        cout << "  advance_clock <minutes>        (e.g. advance_clock 15)" << endl;
+        cout << "  locate_machine <id>            (e.g. locate_machine ABC123)" << endl;
+        cout << "  longest_parked <n>             (e.g. longest_parked 10)" << endl;
+        cout << "  parked_longer <minutes>        (e.g. parked_longer 4320)" << endl;
+        cout << "  run_oracle <ops> <slots> <seed> (e.g. run_oracle 1000000 256 7)" << endl;
+        cout << "  reserve_machine <id> <type>    (e.g. reserve_machine BUS42 Truck)" << endl;
+        cout << "  cancel_reservation <id>        (e.g. cancel_reservation BUS42)" << endl;
+        cout << "  waitlist                       (Machines waiting for space)" << endl;
+        cout << "  leave_waitlist <id>            (e.g. leave_waitlist ABC123)" << endl;
+        cout << "  export_snapshot <file>         (e.g. export_snapshot garage.snap)" << endl;
+        cout << "  sensor_export <file>           (e.g. sensor_export sensors.bin)" << endl;
+        cout << "  reconcile <file> <report|fix>  (e.g. reconcile sensors.bin report)" << endl;
+        cout << "  import_snapshot <file>         (e.g. import_snapshot garage.snap)" << endl;
+        cout << "  wal_enable <dir>               (e.g. wal_enable garage-log)" << endl;
+        cout << "  wal_recover <dir>              (e.g. wal_recover garage-log)" << endl;
+        cout << "  wal_stats" << endl;
+        cout << "  hot_restart <binary>           (e.g. hot_restart ./Design)" << endl;
+        cout << "  stress_test <threads> <ops>    (e.g. stress_test 8 200000)" << endl;
+        cout << "  registry_fill <count> <seed>   (e.g. registry_fill 1000000 7)" << endl;
+        cout << "  camera_bench <reads> <seed>    (e.g. camera_bench 1000000 7)" << endl;
+        cout << "  clock_bench <reads>            (e.g. clock_bench 10000000)" << endl;
+        cout << "  counter_bench <slots> <seed>   (e.g. counter_bench 4096 7)" << endl;
+        cout << "  perf_regress <dir> <tolerance> (e.g. perf_regress scenarios 0.25)" << endl;
+        cout << "  perf_baseline <dir>            (e.g. perf_baseline scenarios)" << endl;
+        cout << "  commands                      (Show the list of commands again)" << endl;
+        cout << "  quit" << endl;
+    }
+
+    // Attempt to park (store) a machine.
+    bool storeMachine(const Machine& machine) {
+        lock_guard<mutex> lock(garageMutex);
+        if (!plateFits(machine)) return false;
+
+        // A reserved arrival already has its slots and records; just commit it.
+        uint32_t inside = findInside(machine.identifier);
+        int releasedLevel = -1;  // Level of a reservation given up below
+        if (inside != kNoHandle && records[inside].pending) {
+            MachineRecord& rec = records[inside];
+            if (rec.kind == machine.kind) {
+                rec.pending = false;
+                beginStay(inside);
+                traffic.record(rec.level, rec.enteredMinute, true);
+                logPlate(WalOp::Commit, machine.kind, machine.identifier, rec.enteredMinute);
+                *console << "Successfully stored machine '" << machine.identifier << "' on Level "
+                     << rec.level << " in reserved slot(s): ";
+                for (int s : slotsOf(rec)) *console << s << " ";
+                *console << endl;
+                return true;
+            }
+            // It turned up as a different kind, so the reservation doesn't fit.
+            // Its space goes to the waitlist once the arrival has been placed.
+            MachineKind reservedKind = rec.kind;
+            releasedLevel = rec.level;
+            releaseMachine(inside);
+            logPlate(WalOp::Cancel, reservedKind, machine.identifier);
+            inside = kNoHandle;
+        }
+
+        // If it's already stored, let the user know.
+        if (inside != kNoHandle) {
+            *console << "Machine with ID " << machine.identifier << " is already parked." << endl;
+            return false;
+        }
+
+        forecaster.recordArrival(machine.kind, nowMinute());
+
+        // Otherwise, try to find a level with enough free slots.
+        Machine arriving = machine;
+        arriving.handle = acquireHandle(machine.identifier);
+        bool wasWaiting = records[arriving.handle].waitTicket != 0;
+        int whichLevel;
+        vector<int> slotIndices;
+        if (placeMachine(arriving, whichLevel, slotIndices)) {
+            traffic.record(whichLevel, records[arriving.handle].enteredMinute, true);
+            logPlacement(WalOp::Store, arriving, whichLevel, slotIndices);
+            *console << "Successfully stored machine '" << machine.identifier << "' on Level "
+                 << whichLevel << " in slot(s): ";
+            for (int s : slotIndices) *console << s << " ";
+            *console << endl;
+            if (releasedLevel >= 0) matchWaitlist(releasedLevel);
+            return true;
+        }
+
+        // If we couldn't find space, the machine waits for a departure.
+        *console << "No suitable space found for machine ID: " << machine.identifier;
+        if (wasWaiting) {
+            releaseHandle(arriving.handle);
+            *console << "; it is still on the waitlist." << endl;
+        } else if (waitlist.count(machine.kind) < waitlistLimit) {
+            compactWaitlist(machine.kind);
+            records[arriving.handle].kind = machine.kind;
+            records[arriving.handle].waitTicket = waitlist.add(machine.kind, arriving.handle);
+            *console << "; added to the " << kindToString(machine.kind) << " waitlist (position "
+                     << waitlist.count(machine.kind) << ")." << endl;
+        } else {
+            releaseHandle(arriving.handle);
+            *console << "." << endl;
+        }
+        if (releasedLevel >= 0) matchWaitlist(releasedLevel);
+        return false;
+    }
+
+    // Remove an existing machine from the garage.
+    bool unparkMachine(const string& machineId) {
+        lock_guard<mutex> lock(garageMutex);
+        // Check if it's recorded.
+        uint32_t h = findInside(machineId);
+        if (h == kNoHandle) {
+            *console << "Machine with ID " << machineId << " not found in the garage." << endl;
+            return false;
+        }
+        if (records[h].pending) {
+            *console << "Machine with ID " << machineId << " is reserved but has not arrived yet." << endl;
+            return false;
+        }
+
+        // Identify the level.
+        int whichLevel = records[h].level;
+        MachineKind kind = records[h].kind;
+        // Let the level remove it.
+        if (releaseMachine(h, true)) {
+            traffic.record(whichLevel, nowMinute(), false);
+            logPlate(WalOp::Unpark, kind, machineId);
+            *console << "Machine '" << machineId << "' has been removed from Level " << whichLevel << "." << endl;
+            matchWaitlist(whichLevel);
+            return true;
+        }
+        return false;
+    }
+
+    // Pre-allocate space for a machine we expect (e.g. a scheduled shuttle).
+    // Slots are chosen and records created now, so the gate event later is
+    // only a commit in storeMachine.
+    bool reserveMachine(const Machine& machine) {
+        lock_guard<mutex> lock(garageMutex);
+        if (!plateFits(machine)) return false;
+        if (findInside(machine.identifier) != kNoHandle) {
+            *console << "Machine with ID " << machine.identifier << " is already parked or reserved." << endl;
+            return false;
+        }
+        forecaster.recordArrival(machine.kind, nowMinute());
+        Machine expected = machine;
+        expected.handle = acquireHandle(machine.identifier);
+        int whichLevel;
+        vector<int> slotIndices;
+        if (!placeMachine(expected, whichLevel, slotIndices)) {
+            releaseHandle(expected.handle);
+            *console << "No suitable space to reserve for machine ID: " << machine.identifier << "." << endl;
+            return false;
+        }
+        holdForArrival(expected.handle);
+        logPlacement(WalOp::Reserve, expected, whichLevel, slotIndices);
+        *console << "Reserved Level " << whichLevel << " slot(s): ";
+        for (int s : slotIndices) *console << s << " ";
+        *console << "for machine '" << machine.identifier << "'." << endl;
+        return true;
+    }
+
+    // Give back the space held for a machine that never arrived.
+    bool cancelReservation(const string& machineId) {
+        lock_guard<mutex> lock(garageMutex);
+        uint32_t h = findInside(machineId);
+        if (h == kNoHandle || !records[h].pending) {
+            *console << "No pending reservation for machine ID " << machineId << "." << endl;
+            return false;
+        }
+        MachineKind kind = records[h].kind;
+        int whichLevel = records[h].level;
+        releaseMachine(h);
+        logPlate(WalOp::Cancel, kind, machineId);
+        *console << "Reservation for machine '" << machineId << "' cancelled." << endl;
+        matchWaitlist(whichLevel);
+        return true;
+    }
+
+    // Take a machine off the waitlist (the driver gave up).
+    bool leaveWaitlist(const string& machineId) {
+        lock_guard<mutex> lock(garageMutex);
+        uint32_t h = ids.find(machineId);
+        if (h == kNoHandle || records[h].waitTicket == 0) {
+            *console << "Machine with ID " << machineId << " is not on the waitlist." << endl;
+            return false;
+        }
+        records[h].waitTicket = 0;
+        waitlist.removed(records[h].kind);
+        compactWaitlist(records[h].kind);
+        *console << "Machine '" << machineId << "' left the " << kindToString(records[h].kind)
+                 << " waitlist." << endl;
+        return true;
+    }
+
+    // The n machines parked longest, oldest first. Walks the arrival
+    // list from its old end, so the cost grows with n, not the garage.
+    void showLongestParked(long long n) {
+        lock_guard<mutex> lock(garageMutex);
+        long long now = nowMinute();
+        *console << "\n=== Longest Parked ===" << endl;
+        long long shown = 0;
+        for (uint32_t h = oldestStay; h != kNoHandle && shown < n; h = records[h].nextStay, ++shown) {
+            printStay(h, now);
+        }
+        if (shown == 0) *console << "Nothing is parked." << endl;
+    }
+
+    // Every machine parked longer than the given minutes, e.g. for an
+    // abandoned-vehicle sweep. Stops at the first later arrival.
+    void showParkedLonger(long long minutes) {
+        lock_guard<mutex> lock(garageMutex);
+        long long now = nowMinute();
+        *console << "\n=== Parked Longer Than " << formatMinutes(minutes) << " ===" << endl;
+        long long shown = 0;
+        for (uint32_t h = oldestStay; h != kNoHandle && now - records[h].enteredMinute > minutes;
+             h = records[h].nextStay, ++shown) {
+            printStay(h, now);
+        }
+        *console << shown << " machine(s)." << endl;
+    }
+
+    // Show how many machines of each kind are waiting, and who is next.
+    void showWaitlist() {
+        lock_guard<mutex> lock(garageMutex);
+        *console << "\n=== Waitlist ===" << endl;
+        for (int k = 0; k < 3; ++k) {
+            MachineKind kind = MachineKind(k);
+            trimWaitlist(waitlist.queue(kind));
+            *console << kindToString(kind) << ": " << waitlist.count(kind) << " waiting";
+            if (!waitlist.queue(kind).empty()) {
+                *console << ", next is " << ids.name(waitlist.queue(kind).front().handle);
+            }
+            *console << "." << endl;
+        }
+    }
+
+    // Show how many free slots each level has.
+    void checkAvailability() {
+        lock_guard<mutex> lock(garageMutex);
+        *console << "\n=== Current Availability ===" << endl;
+        for (auto& lvl : levels) {
+            *console << "Level " << lvl.levelIndex << ": " << lvl.freeSlotsCount() << " slot(s) free";
+            if (lvl.openBikeBays() > 0) *console << ", " << lvl.openBikeBays() << " bike bay(s) open";
+            *console << "." << endl;
+        }
+        // One pass over every level's occupancy words at once.
+        int occupied = 0;
+        for (uint64_t w : levelStore.allWords()) occupied += countBits(w);
+        *console << "Total: " << levelStore.totalSlots() - occupied << " of "
+                 << levelStore.totalSlots() << " slot(s) free." << endl;
+    }
+
+    // Draw every level, top floor first.
+    void showMap() {
+        lock_guard<mutex> lock(garageMutex);
+        *console << "\n=== Garage Map ===" << endl;
+        for (int i = int(levels.size()) - 1; i >= 0; --i) {
+            *console << "Level " << i << "  " << mapRenderer.render(levels[i].occupancy) << endl;
+        }
+        *console << "\u25A1 = Empty Slot    \u25A0 = Occupied Slot" << endl;
+    }
+
+    // Emit only what changed since the previous dashboard frame.
+    void renderDashboard(DashboardMode mode) {
+        lock_guard<mutex> lock(garageMutex);
+        dashboardBuffer.clear();
+        int changed = dashboard.frame(levels, mode, dashboardBuffer);
+        *console << dashboardBuffer;
+        if (mode == DashboardMode::DiffRecords) {
+            *console << "(" << changed << " changed segment(s))" << endl;
+        }
+    }
+
+    // Print expected arrivals for the current and next few time buckets.
+    void showForecast() {
+        lock_guard<mutex> lock(garageMutex);
+        long long now = nowMinute();
+        forecaster.advanceTo(now);
+        *console << "\n=== Demand Forecast (arrivals per " << kForecastBucketMinutes << " min) ===" << endl;
+        for (int step = 0; step < 4; ++step) {
+            long long minute = now + step * kForecastBucketMinutes;
+            int start = DemandForecaster::bucketOfDay(minute) * kForecastBucketMinutes;
+            *console << formatTimeOfDay(start) << "  Bike " << forecaster.expected(MachineKind::Bike, minute)
+                     << ", Car " << forecaster.expected(MachineKind::Car, minute)
+                     << ", Truck " << forecaster.expected(MachineKind::Truck, minute) << endl;
+        }
+        *console << "Keeping pairs open for trucks: "
+                 << (keepPairsFor(Machine("", MachineKind::Car)) ? "yes" : "no") << endl;
+    }
+
+    // Entries and exits on each level for the last few minutes, newest first.
+    void showMetrics(int minutes) {
+        lock_guard<mutex> lock(garageMutex);
+        minutes = max(1, min(minutes, kTrafficMinutes));
+        long long now = nowMinute();
+        *console << "\n=== Traffic (entries/exits per minute, " << traffic.shardCount()
+                 << " thread shard(s)) ===" << endl;
+        *console << "Minute";
+        for (const auto& lvl : levels) *console << "\tLevel " << lvl.levelIndex;
+        *console << "\tTotal" << endl;
+        for (long long minute = now; minute > now - minutes; --minute) {
+            *console << formatTimeOfDay(minute);
+            long long allIn = 0, allOut = 0;
+            for (const auto& lvl : levels) {
+                long long in, out;
+                traffic.totals(lvl.levelIndex, minute, in, out);
+                *console << "\t" << in << "/" << out;
+                allIn += in;
+                allOut += out;
+            }
+            *console << "\t" << allIn << "/" << allOut << endl;
+        }
+    }
+
+    // Move the garage clock forward, e.g. to replay a day of arrivals.
+    // The clock never runs backwards, and the total skew stays bounded so
+    // nowMinute() cannot overflow. Returns false if the move is rejected.
+    bool advanceClock(long long minutes) {
+        lock_guard<mutex> lock(garageMutex);
+        if (minutes < 0 || minutes > kMaxClockSkewMinutes - clockSkewMinutes) return false;
+        clockSkewMinutes += minutes;
+        forecaster.advanceTo(nowMinute());
+        return true;
+    }
+
+    // Verify if the entire garage is full.
+    void checkIfFull() {
+        lock_guard<mutex> lock(garageMutex);
+        for (auto& lvl : levels) {
             if (lvl.freeSlotsCount() > 0) {
-                cout << "The garage still has space available." << endl;
+                *console << "The garage still has space available." << endl;
+                return;
+            }
+        }
+        *console << "The garage is completely full." << endl;
+    }
+
+    // Locate a machine by its ID, and display its type as well.
+    void locateMachine(const string& machineId) {
+        lock_guard<mutex> lock(garageMutex);
+        // See if it's recorded.
+        uint32_t h = findInside(machineId);
+        if (h == kNoHandle) {
+            *console << "Could not find machine ID " << machineId << " in the garage." << endl;
+            return;
+        }
+        const MachineRecord& rec = records[h];
+        int lvlIndex = rec.level;
+        vector<int> slots = slotsOf(rec);
+        string typeName = kindToString(rec.kind);
+
+        if (rec.pending) {
+            *console << "Machine '" << machineId << "' (" << typeName << ") has not arrived; reserved on Level "
+                 << lvlIndex << " slot(s): ";
+        } else {
+            *console << "Machine '" << machineId << "' (" << typeName << ") is on Level " << lvlIndex << " occupying slot(s): ";
+        }
+        for (int s : slots) *console << s << " ";
+        if (rec.kind == MachineKind::Bike) {
+            *console << "(bay " << levels[lvlIndex].bikePool.bayOf(slots[0], h) << ")";
+        }
+        *console << endl;
+    }
+
+    // What perfect sensors would report right now: every occupied slot
+    // except those held for reservations that haven't arrived.
+    SensorFrame sensorView() const {
+        lock_guard<mutex> lock(garageMutex);
+        SensorFrame frame;
+        for (const auto& lvl : levels) frame.slotCounts.push_back(int(lvl.slotList.size()));
+        frame.words = levelStore.allWords();
+        vector<size_t> firstWord = levelWordStarts();
+        for (uint32_t h = 0; h < records.size(); ++h) {
+            const MachineRecord& rec = records[h];
+            if (rec.level < 0 || !rec.pending) continue;
+            for (int slot : slotsOf(rec)) {
+                if (!onlyReservedAt(rec.level, slot)) continue;
+                frame.words[firstWord[rec.level] + slot / 64] &= ~(uint64_t(1) << (slot % 64));
+            }
+        }
+        return frame;
+    }
+
+    // Compare a sensor frame with our occupancy, one XOR per 64 slots,
+    // and list the slots that disagree. Reserved slots are expected to
+    // read empty. With fix the sensors win: vehicles whose slot reads
+    // empty are released as departed (reservations there are left
+    // alone, they haven't arrived), and a slot that reads occupied but
+    // is free here gets a placeholder car (SENSOR-<level>-<slot>) until
+    // it reads empty again.
+    bool reconcileSensors(const SensorFrame& frame, bool fix, string& error) {
+        lock_guard<mutex> lock(garageMutex);
+        if (frame.slotCounts.size() != levels.size()) {
+            error = "the frame has " + to_string(frame.slotCounts.size()) + " level(s), the garage " +
+                    to_string(levels.size());
+            return false;
+        }
+        for (size_t l = 0; l < levels.size(); ++l) {
+            if (frame.slotCounts[l] != int(levels[l].slotList.size())) {
+                error = "level " + to_string(l) + " has " + to_string(frame.slotCounts[l]) +
+                        " sensor(s) but " + to_string(levels[l].slotList.size()) + " slot(s)";
+                return false;
+            }
+        }
+
+        // One pass over the whole garage; clean stretches are skipped
+        // four words (256 slots) at a time.
+        auto start = chrono::steady_clock::now();
+        const vector<uint64_t>& own = levelStore.allWords();
+        const uint64_t* seen = frame.words.data();
+        vector<size_t> dirtyWords;
+        size_t w = 0;
+        for (; w + 4 <= own.size(); w += 4) {
+            if (((own[w] ^ seen[w]) | (own[w + 1] ^ seen[w + 1]) | (own[w + 2] ^ seen[w + 2]) |
+                 (own[w + 3] ^ seen[w + 3])) == 0) {
+                continue;
+            }
+            for (size_t k = w; k < w + 4; ++k) {
+                if (own[k] != seen[k]) dirtyWords.push_back(k);
+            }
+        }
+        for (; w < own.size(); ++w) {
+            if (own[w] != seen[w]) dirtyWords.push_back(w);
+        }
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+        struct Mismatch {
+            int level;
+            int slot;
+            bool seen;  // Sensor reads occupied
+        };
+        vector<Mismatch> mismatches;
+        vector<size_t> firstWord = levelWordStarts();
+        int level = 0;
+        for (size_t dw : dirtyWords) {
+            while (dw >= firstWord[level + 1]) level++;
+            for (uint64_t diff = own[dw] ^ seen[dw]; diff; diff &= diff - 1) {
+                int bit = lowestSetBit(diff);
+                int slot = int(dw - firstWord[level]) * 64 + bit;
+                if (slot >= int(levels[level].slotList.size())) break;  // Padding past the last slot
+                bool seenHere = (seen[dw] >> bit) & 1;
+                if (!seenHere && onlyReservedAt(level, slot)) continue;
+                mismatches.push_back({level, slot, seenHere});
+            }
+        }
+
+        *console << "\n=== Sensor Reconcile ===" << endl;
+        *console << "Compared " << levelStore.totalSlots() << " slot(s) in " << micros << " us: "
+                 << mismatches.size() << " mismatch(es)." << endl;
+        for (size_t i = 0; i < mismatches.size() && i < size_t(kSensorReportLimit); ++i) {
+            const Mismatch& m = mismatches[i];
+            const Slot& s = levels[m.level].slotList[m.slot];
+            *console << "  Level " << m.level << " slot " << m.slot << ": ";
+            if (m.seen) {
+                *console << "sensor sees a vehicle, garage has it free" << endl;
+            } else if (s.isBikeZone) {
+                *console << "sensor sees nothing, garage has bikes there" << endl;
+            } else {
+                *console << "sensor sees nothing, garage has " << ids.name(s.occupant) << " there" << endl;
+            }
+        }
+        if (mismatches.size() > size_t(kSensorReportLimit)) {
+            *console << "  ... and " << mismatches.size() - kSensorReportLimit << " more" << endl;
+        }
+        if (!fix || mismatches.empty()) return true;
+
+        // Release what the sensors say has gone. A truck goes as a whole,
+        // so its other slot is checked for a placeholder too.
+        vector<Mismatch> occupiedReads;
+        vector<bool> freed(levels.size(), false);
+        int released = 0, placeholders = 0;
+        for (const Mismatch& m : mismatches) {
+            if (m.seen) {
+                occupiedReads.push_back(m);
+                continue;
+            }
+            const Slot& s = levels[m.level].slotList[m.slot];
+            if (!s.isOccupied) continue;  // Went with a truck released through its other slot
+            vector<uint32_t> gone;
+            if (s.isBikeZone) {
+                for (int b = 0; b < levels[m.level].bikePool.baysPerSlot; ++b) {
+                    uint32_t bike = levels[m.level].bikePool.bayOccupant(m.slot, b);
+                    if (bike != kNoHandle && !records[bike].pending) gone.push_back(bike);
+                }
+            } else if (!records[s.occupant].pending) {
+                gone.push_back(s.occupant);
+            }
+            for (uint32_t h : gone) {
+                for (int slot : slotsOf(records[h])) {
+                    if (slot != m.slot) occupiedReads.push_back({m.level, slot, true});
+                }
+                MachineKind kind = records[h].kind;
+                string plate = ids.name(h);
+                if (releaseMachine(h, true)) {
+                    traffic.record(m.level, nowMinute(), false);
+                    logPlate(WalOp::Unpark, kind, plate);
+                    released++;
+                }
+            }
+            freed[m.level] = true;
+        }
+
+        // Hold every slot that reads occupied but is free here.
+        for (const Mismatch& m : occupiedReads) {
+            uint64_t word = seen[firstWord[m.level] + m.slot / 64];
+            if (!((word >> (m.slot % 64)) & 1) || levels[m.level].slotList[m.slot].isOccupied) continue;
+            Machine unknown("SENSOR-" + to_string(m.level) + "-" + to_string(m.slot), MachineKind::Car);
+            if (findInside(unknown.identifier) != kNoHandle) continue;
+            unknown.handle = acquireHandle(unknown.identifier);
+            vector<int> slots = {m.slot};
+            if (!levels[m.level].assignMachine(unknown, slots)) {
+                releaseHandle(unknown.handle);
+                continue;
+            }
+            recordPlacement(unknown, m.level, slots);
+            logPlacement(WalOp::Store, unknown, m.level, slots);
+            placeholders++;
+        }
+        *console << "Fixed: " << released << " vehicle(s) released, " << placeholders
+                 << " placeholder(s) parked." << endl;
+        for (size_t l = 0; l < levels.size(); ++l) {
+            if (freed[l]) matchWaitlist(int(l));
+        }
+        return true;
+    }
+
+    // Write the whole garage as a binary snapshot.
+    bool exportSnapshot(ostream& out) const {
+        lock_guard<mutex> lock(garageMutex);
+        writeSnapshot(out);
+        return bool(out);
+    }
+
+    // Replace the whole garage with a snapshot, building the registry in
+    // one pass. On error the current state is left untouched.
+    bool importSnapshot(istream& in, string& error) {
+        LoadedSnapshot snap;
+        if (!parseSnapshot(in, nowMinute(), snap, error)) return false;
+
+        unique_lock<mutex> lock(garageMutex);
+        levels.swap(snap.levels);
+        levelStore.swap(snap.store);
+        ids = move(snap.ids);
+        records.swap(snap.records);
+        machinesInside = snap.machineCount;
+        oldestStay = snap.oldest;
+        newestStay = snap.newest;
+        // Old handles mean nothing in the new table.
+        recentDepartures = DepartureCache(departureCacheSize);
+        waitlist = Waitlist();
+        traffic = TrafficCounters(int(levels.size()));
+        dashboard = DashboardRenderer();
+        // Earlier log records don't apply to the imported state; rebase the
+        // log, or stop it so nothing is logged on top of the old state.
+        if (wal && !compactLog(lock)) {
+            wal->fail("cannot write a snapshot of the imported state");
+            *console << "WARNING: logging is off (" << wal->failureReason()
+                     << "); the log still recovers the state from before the import." << endl;
+            compactorWake.notify_one();
+        }
+        return true;
+    }
+
+    // Write everything a successor process needs to carry on (see the
+    // handoff image above). The compactor is stopped and the active log
+    // segment sealed first, so nothing changes on disk while the successor
+    // starts; it resumes logging in the next segment. If no successor
+    // takes over, call cancelHandoff.
+    bool writeHandoff(ostream& out, long long startedNs) {
+        stopCompactorThread();
+        lock_guard<mutex> lock(garageMutex);
+        out.write(kHandoffMagic, sizeof(kHandoffMagic));
+        writePod(out, kHandoffVersion);
+        writePod(out, startedNs);
+        writePod(out, truckDemandThreshold);
+        writePod(out, uint64_t(departureCacheSize));
+        writePod(out, clockSkewMinutes);
+        writeForecaster(out);
+        writePod(out, uint64_t(waitlistLimit));
+        string dir = wal && !wal->failed() ? wal->dir() : string();
+        writePod(out, uint16_t(dir.size()));
+        out.write(dir.data(), dir.size());
+        writePod(out, wal ? wal->activeSegment() + 1 : uint64_t(0));
+        writePod(out, wal ? wal->oldestSegment() : uint64_t(0));
+        if (wal) wal->close();
+        writeSnapshot(out);
+
+        // Merge the lines back into one queue by ticket.
+        vector<WaitEntry> waiting;
+        for (int k = 0; k < 3; ++k) {
+            for (const WaitEntry& e : waitlist.queue(MachineKind(k))) {
+                if (records[e.handle].waitTicket == e.ticket) waiting.push_back(e);
+            }
+        }
+        sort(waiting.begin(), waiting.end(), [](const WaitEntry& a, const WaitEntry& b) {
+            return Waitlist::earlier(a.ticket, b.ticket);
+        });
+        writePod(out, uint32_t(waiting.size()));
+        for (const WaitEntry& e : waiting) {
+            const string& plate = ids.name(e.handle);
+            writePod(out, uint8_t(records[e.handle].kind));
+            writePod(out, uint16_t(plate.size()));
+            out.write(plate.data(), plate.size());
+        }
+        return bool(out);
+    }
+
+    // Carry on here after a handoff that went nowhere.
+    void cancelHandoff() {
+        lock_guard<mutex> lock(garageMutex);
+        if (!wal) return;
+        wal->roll();
+        compactor = thread(&Garage::runCompactor, this);
+    }
+
+    // Become the garage described by a predecessor's handoff image,
+    // logging where it left off. Call on a freshly built garage. Recent
+    // departures are not carried over, as their handles are renumbered.
+    bool takeOver(istream& in, long long& startedNs, string& error) {
+        char magic[8];
+        uint32_t version;
+        if (!in.read(magic, sizeof(magic)) || !equal(magic, magic + 8, kHandoffMagic)) {
+            error = "not a handoff image";
+            return false;
+        }
+        if (!readPod(in, version) || version == 0 || version > kHandoffVersion) {
+            error = "unsupported handoff version";
+            return false;
+        }
+        uint64_t cacheSize, limit = waitlistLimit, nextSegment, oldestKept;
+        uint16_t dirLength;
+        string dir;
+        if (!readPod(in, startedNs) || !readPod(in, truckDemandThreshold) || !readPod(in, cacheSize) ||
+            !readPod(in, clockSkewMinutes) || !readForecaster(in, version, error) ||
+            (version >= 2 && !readPod(in, limit)) || !readPod(in, dirLength)) {
+            if (error.empty()) error = "truncated handoff header";
+            return false;
+        }
+        dir.resize(dirLength);
+        if ((dirLength && !in.read(&dir[0], dirLength)) || !readPod(in, nextSegment) ||
+            !readPod(in, oldestKept) || cacheSize == 0) {
+            error = "truncated handoff header";
+            return false;
+        }
+        departureCacheSize = size_t(cacheSize);
+        waitlistLimit = size_t(limit);
+        if (!importSnapshot(in, error)) return false;
+
+        lock_guard<mutex> lock(garageMutex);
+        uint32_t waitingCount = 0;
+        if (version >= 2 && !readPod(in, waitingCount)) {
+            error = "truncated waitlist";
+            return false;
+        }
+        string plate;
+        for (uint32_t i = 0; i < waitingCount; ++i) {
+            uint8_t kind;
+            uint16_t length;
+            if (!readPod(in, kind) || !readPod(in, length) || kind > 2) {
+                error = "corrupt waitlist";
+                return false;
+            }
+            plate.resize(length);
+            if (length && !in.read(&plate[0], length)) {
+                error = "corrupt waitlist";
+                return false;
+            }
+            uint32_t h = acquireHandle(plate);
+            records[h].kind = MachineKind(kind);
+            records[h].waitTicket = waitlist.add(MachineKind(kind), h);
+        }
+        if (dir.empty()) return true;
+
+        wal.reset(new OperationLog());
+        if (!wal->open(dir, nextSegment, oldestKept)) {
+            wal.reset();
+            error = "cannot create a log segment in " + dir;
+            return false;
+        }
+        compactor = thread(&Garage::runCompactor, this);
+        return true;
+    }
+
+    // Slots on each level, bottom first.
+    vector<int> levelSizes() const {
+        lock_guard<mutex> lock(garageMutex);
+        vector<int> sizes;
+        for (const auto& lvl : levels) sizes.push_back(int(lvl.slotList.size()));
+        return sizes;
+    }
+
+    // Pick up the log in dir if there is one, else start a new one there.
+    bool openLog(const string& dir, string& error) {
+        long long newestSnapshot, newestSegment;
+        if (scanLogDirectory(dir, newestSnapshot, newestSegment) && newestSnapshot >= 0) {
+            return recoverFromLog(dir, error) >= 0;
+        }
+        return enableLog(dir, error);
+    }
+
+    // Start logging every change to dir, beginning with a base snapshot.
+    bool enableLog(const string& dir, string& error) {
+        discardFailedLog();
+        unique_lock<mutex> lock(garageMutex);
+        if (wal) {
+            error = "already logging to " + wal->dir();
+            return false;
+        }
+        long long newestSnapshot, newestSegment;
+        mkdir(dir.c_str(), 0755);
+        if (!scanLogDirectory(dir, newestSnapshot, newestSegment)) {
+            error = "cannot open directory " + dir;
+            return false;
+        }
+        if (newestSnapshot >= 0 || newestSegment >= 0) {
+            error = dir + " already holds a log; use wal_recover";
+            return false;
+        }
+        wal.reset(new OperationLog());
+        if (!wal->open(dir, 0, 0)) {
+            wal.reset();
+            error = "cannot create a log segment in " + dir;
+            return false;
+        }
+        if (!compactLog(lock)) {
+            error = wal->failed() ? wal->failureReason() : "cannot write a snapshot in " + dir;
+            wal.reset();
+            return false;
+        }
+        compactor = thread(&Garage::runCompactor, this);
+        return true;
+    }
+
+    // Rebuild state from the newest snapshot in dir plus the segments after
+    // it, then keep logging there. Returns the number of records replayed.
+    long long recoverFromLog(const string& dir, string& error) {
+        long long newestSnapshot, newestSegment;
+        discardFailedLog();
+        if (wal) {
+            error = "already logging to " + wal->dir();
+            return -1;
+        }
+        if (!scanLogDirectory(dir, newestSnapshot, newestSegment) || newestSnapshot < 0) {
+            error = "no snapshot found in " + dir;
+            return -1;
+        }
+        ifstream image(OperationLog::snapshotPath(dir, newestSnapshot), ios::binary);
+        if (!importSnapshot(image, error)) return -1;
+
+        // Only the newest segment can be cut short by a crash: torn at
+        // creation, it is reused; torn mid-record, it is trimmed to its
+        // last whole record. A gap anywhere earlier loses acknowledged
+        // changes, so recovery stops there.
+        unique_lock<mutex> lock(garageMutex);
+        long long replayed = 0;
+        uint64_t nextSegment = uint64_t(max(newestSegment, newestSnapshot) + 1);
+        for (long long n = newestSnapshot; n <= newestSegment; ++n) {
+            string path = OperationLog::segmentPath(dir, n);
+            ifstream in(path, ios::binary);
+            string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+            WalReader reader(bytes);
+            bool last = n == newestSegment;
+            if (!reader.validHeader()) {
+                if (!last) {
+                    error = path + " is missing or damaged";
+                    return -1;
+                }
+                nextSegment = uint64_t(n);
+                continue;
+            }
+            WalRecord rec;
+            while (reader.next(rec)) {
+                if (!replayRecord(rec, error)) return -1;
+                replayed++;
+            }
+            if (!reader.complete()) {
+                if (!last) {
+                    error = path + " is torn before its last record";
+                    return -1;
+                }
+                if (truncate(path.c_str(), off_t(reader.validBytes())) != 0 || !syncPath(path)) {
+                    error = "cannot trim the torn tail of " + path;
+                    return -1;
+                }
+            }
+        }
+        wal.reset(new OperationLog());
+        if (!wal->open(dir, nextSegment, uint64_t(newestSnapshot))) {
+            wal.reset();
+            error = "cannot create a log segment in " + dir;
+            return -1;
+        }
+        // If this snapshot can't be written, the segments just replayed
+        // stay on disk and the compactor tries again later.
+        compactLog(lock);
+        compactor = thread(&Garage::runCompactor, this);
+        return replayed;
+    }
+
+    // Report how compact and how fast the log is.
+    void showLogStats() {
+        lock_guard<mutex> lock(garageMutex);
+        if (!wal) {
+            *console << "The operation log is not enabled." << endl;
+            return;
+        }
+        wal->flush();
+        long long ops = wal->operations();
+        *console << "\n=== Operation Log ===" << endl;
+        *console << "Directory: " << wal->dir() << ", active segment " << wal->activeSegment()
+                 << ", " << wal->sealedSegments() << " sealed, " << wal->compactionCount()
+                 << " compaction(s)" << endl;
+        if (wal->failed()) *console << "Stopped: " << wal->failureReason() << endl;
+        *console << "Logged " << ops << " op(s) in " << wal->bytes() << " byte(s)";
+        if (ops > 0) *console << " (" << double(wal->bytes()) / ops << " bytes/op)";
+        *console << endl;
+        if (wal->secondsWriting() > 0) {
+            *console << "Write throughput: " << wal->bytes() / wal->secondsWriting() / (1 << 20)
+                     << " MiB/s, " << static_cast<long long>(ops / wal->secondsWriting()) << " ops/sec" << endl;
+        }
+    }
+
+    // Cross-check levels against the registry. Returns false and describes
+    // the first problem found: a slot owned by an unknown machine, a record
+    // pointing at slots it doesn't hold, or counts that don't add up.
+    bool verifyInvariants(string& problem) const {
+        lock_guard<mutex> lock(garageMutex);
+        if (records.size() < ids.size()) {
+            problem = "fewer records than interned plates";
+            return false;
+        }
+        int slotsClaimed = 0;
+        int bikesClaimed = 0;
+        size_t inside = 0;
+        size_t waiting[3] = {0, 0, 0};
+        for (uint32_t h = 0; h < records.size(); ++h) {
+            const MachineRecord& rec = records[h];
+            if (rec.waitTicket != 0) {
+                if (rec.level >= 0) {
+                    problem = ids.name(h) + " is both parked and waiting";
+                    return false;
+                }
+                waiting[int(rec.kind)]++;
+            }
+            if (rec.level < 0) continue;
+            inside++;
+            const string& id = ids.name(h);
+            if (ids.find(id) != h) {
+                problem = "record " + to_string(h) + " has no interned plate";
+                return false;
+            }
+            int lvl = rec.level;
+            vector<int> slots = slotsOf(rec);
+            if (lvl >= int(levels.size()) || rec.firstSlot < 0 ||
+                slots.back() >= int(levels[lvl].slotList.size())) {
+                problem = id + " has a malformed location";
+                return false;
+            }
+            if (rec.kind == MachineKind::Bike) {
+                if (levels[lvl].bikePool.bayOf(slots[0], h) < 0) {
+                    problem = id + " is not in a bay of slot " + to_string(slots[0]) +
+                              " on Level " + to_string(lvl);
+                    return false;
+                }
+                bikesClaimed++;
+                continue;
+            }
+            for (int idx : slots) {
+                const Slot& s = levels[lvl].slotList[idx];
+                if (!s.isOccupied || s.isBikeZone || s.occupant != h) {
+                    problem = id + " is recorded in slot " + to_string(idx) +
+                              " on Level " + to_string(lvl) + " but does not hold it";
+                    return false;
+                }
+            }
+            slotsClaimed += int(slots.size());
+        }
+        if (inside != machinesInside) {
+            problem = to_string(inside) + " live record(s) but " + to_string(machinesInside) + " counted";
+            return false;
+        }
+        size_t stays = 0, reserved = 0;
+        for (uint32_t h = 0; h < records.size(); ++h) {
+            if (records[h].level >= 0 && records[h].pending) reserved++;
+        }
+        uint32_t prev = kNoHandle;
+        for (uint32_t h = oldestStay; h != kNoHandle; prev = h, h = records[h].nextStay) {
+            if (records[h].level < 0 || records[h].pending || records[h].prevStay != prev || ++stays > inside) {
+                problem = "arrival list is broken at " + ids.name(h);
+                return false;
+            }
+        }
+        if (prev != newestStay || stays + reserved != inside) {
+            problem = to_string(stays) + " stay(s) listed but " + to_string(inside - reserved) + " parked";
+            return false;
+        }
+        for (int k = 0; k < 3; ++k) {
+            if (waiting[k] != waitlist.count(MachineKind(k))) {
+                problem = to_string(waiting[k]) + " waiting " + kindToString(MachineKind(k)) + "(s) but " +
+                          to_string(waitlist.count(MachineKind(k))) + " counted";
+                return false;
+            }
+        }
+        int slotsOccupied = 0;
+        int bikesParked = 0;
+        for (const auto& lvl : levels) {
+            for (const auto& s : lvl.slotList) {
+                if (lvl.occupancy.test(s.slotIndex) != s.isOccupied) {
+                    problem = "occupancy bitmap out of sync at slot " + to_string(s.slotIndex) +
+                              " on Level " + to_string(lvl.levelIndex);
+                    return false;
+                }
+                if (s.isBikeZone) {
+                    if (lvl.bikePool.bikesIn(s.slotIndex) == 0) {
+                        problem = "empty bike zone at slot " + to_string(s.slotIndex) +
+                                  " on Level " + to_string(lvl.levelIndex);
+                        return false;
+                    }
+                    bikesParked += lvl.bikePool.bikesIn(s.slotIndex);
+                    continue;
+                }
+                if (!s.isOccupied) continue;
+                slotsOccupied++;
+                if (s.occupant >= records.size() || records[s.occupant].level != lvl.levelIndex) {
+                    problem = "slot " + to_string(s.slotIndex) + " on Level " +
+                              to_string(lvl.levelIndex) + " held by unknown handle " + to_string(s.occupant);
+                    return false;
+                }
+            }
+        }
+        if (slotsOccupied != slotsClaimed) {
+            problem = to_string(slotsOccupied) + " slot(s) occupied but " +
+                      to_string(slotsClaimed) + " claimed by the registry";
+            return false;
+        }
+        if (bikesParked != bikesClaimed) {
+            problem = to_string(bikesParked) + " bike(s) in bays but " +
+                      to_string(bikesClaimed) + " in the registry";
+            return false;
+        }
+        return true;
+    }
+};
+
+///////////////////////////////////////////////////////////
+// NullStream: An ostream that discards everything written to it.
+///////////////////////////////////////////////////////////
+class NullStream : public ostream {
+public:
+    NullStream() : ostream(nullptr) {}
+};
+
+///////////////////////////////////////////////////////////
+// Stress test: Many threads hammer one Garage with store, reserve,
+// unpark, locate and availability calls while a checker thread keeps
+// verifying invariants. Plates are shared between threads on purpose
+// so duplicate parks and racing unparks are exercised too.
+//
+// The writers can starve the checker on the garage lock, so each worker
+// also verifies the invariants itself every kStressCheckInterval ops.
+///////////////////////////////////////////////////////////
+const long long kStressCheckInterval = 1024;
+
+static void runStressTest(int threadCount, long long opsPerThread, const vector<int>& slotCounts) {
+    Garage garage(slotCounts);
+    NullStream quiet;
+    garage.setConsole(quiet);
+
+    // Enough distinct plates to keep the garage close to full.
+    int plateCount = 16;
+    for (int n : slotCounts) plateCount += n;
+    atomic<bool> workersDone(false);
+    atomic<long long> checksRun(0);
+    mutex problemMutex;
+    string firstProblem;
+
+    auto recordProblem = [&](const string& what) {
+        lock_guard<mutex> lock(problemMutex);
+        if (firstProblem.empty()) firstProblem = what;
+    };
+
+    auto worker = [&](int seed) {
+        mt19937 rng(seed);
+        string problem;
+        for (long long op = 0; op < opsPerThread; ++op) {
+            string plate = "P" + to_string(rng() % plateCount);
+            unsigned roll = rng() % 100;
+            if (roll < 40) {
+                garage.storeMachine(Machine(plate, MachineKind(rng() % 3)));
+            } else if (roll < 45) {
+                garage.reserveMachine(Machine(plate, MachineKind(rng() % 3)));
+            } else if (roll < 85) {
+                garage.unparkMachine(plate);
+            } else if (roll < 95) {
+                garage.locateMachine(plate);
+            } else {
+                garage.checkAvailability();
+            }
+            if ((op + 1) % kStressCheckInterval == 0) {
+                if (!garage.verifyInvariants(problem)) recordProblem(problem);
+                checksRun++;
+            }
+        }
+    };
+
+    thread checker([&]() {
+        string problem;
+        while (!workersDone.load()) {
+            if (!garage.verifyInvariants(problem)) recordProblem(problem);
+            checksRun++;
+            this_thread::yield();
+        }
+    });
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threadCount; ++t) workers.emplace_back(worker, 1000 + t);
+    for (auto& w : workers) w.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    workersDone = true;
+    checker.join();
+
+    string problem;
+    if (!garage.verifyInvariants(problem)) recordProblem(problem);
+    checksRun++;
+
+    long long totalOps = opsPerThread * threadCount;
+    cout << "\n=== Stress Test ===" << endl;
+    cout << threadCount << " thread(s) x " << opsPerThread << " op(s) on " << slotCounts.size()
+         << " level(s), " << plateCount - 16 << " slot(s) in all" << endl;
+    cout << "Invariant checks: " << checksRun.load() << endl;
+    if (firstProblem.empty()) {
+        cout << "Result: PASS" << endl;
+    } else {
+        cout << "Result: FAIL: " << firstProblem << endl;
+    }
+    if (seconds > 0) {
+        cout << "Throughput: " << static_cast<long long>(totalOps / seconds) << " ops/sec" << endl;
+    }
+}
+
+///////////////////////////////////////////////////////////
+// FastClock: A monotonic timestamp cheap enough to take around every
+// operation. On x86 with an invariant TSC it reads the time-stamp
+// counter, calibrated once against steady_clock on first use; anywhere
+// else it falls back to steady_clock. Readings are ticks; convert a
+// difference with toNanos.
+///////////////////////////////////////////////////////////
+const int kClockCalibrationMs = 10;
+
+class FastClock {
+public:
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        if (calibration().useTsc) return __rdtsc();
+#endif
+        return steadyTicks();
+    }
+
+    static uint64_t toNanos(uint64_t ticks) { return uint64_t(ticks * calibration().nanosPerTick); }
+
+    static bool usesTsc() { return calibration().useTsc; }
+    static double nanosPerTick() { return calibration().nanosPerTick; }
+
+private:
+    struct Calibration {
+        bool useTsc;
+        double nanosPerTick;
+    };
+
+    static uint64_t steadyTicks() {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static const Calibration& calibration() {
+        static const Calibration measured = calibrate();
+        return measured;
+    }
+
+    // Count TSC ticks across a short steady_clock interval. Only a TSC that
+    // ticks at a constant rate through sleep states can stand in for time.
+    static Calibration calibrate() {
+        Calibration result = {false, 1.0};
+#if defined(__x86_64__) || defined(__i386__)
+        ifstream cpuinfo("/proc/cpuinfo");
+        string line;
+        while (getline(cpuinfo, line) && line.compare(0, 5, "flags") != 0) {}
+        if (line.find(" constant_tsc") == string::npos || line.find(" nonstop_tsc") == string::npos) return result;
+        uint64_t startNs = steadyTicks(), startTicks = __rdtsc();
+        while (steadyTicks() - startNs < uint64_t(kClockCalibrationMs) * 1000000) {}
+        uint64_t endTicks = __rdtsc(), endNs = steadyTicks();
+        if (endTicks > startTicks) {
+            result.useTsc = true;
+            result.nanosPerTick = double(endNs - startNs) / double(endTicks - startTicks);
+        }
+#endif
+        return result;
+    }
+};
+
+///////////////////////////////////////////////////////////
+// Clock benchmark: Reads each clock the garage could use many times in
+// a row and reports the cost per read, plus how far FastClock drifts
+// from steady_clock over the whole run.
+///////////////////////////////////////////////////////////
+template <typename Read>
+static double nanosPerRead(long long reads, Read read) {
+    uint64_t sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (long long i = 0; i < reads; ++i) sum += uint64_t(read());
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    volatile uint64_t sink = sum;  // Keep the reads from being optimized away
+    (void)sink;
+    return ns / reads;
+}
+
+static void runClockBench(long long reads) {
+    FastClock::now();  // Calibrate before timing anything
+    cout << "\n=== Clock Bench (" << reads << " reads each) ===" << endl;
+    if (FastClock::usesTsc()) {
+        cout << "FastClock: TSC at " << 1 / FastClock::nanosPerTick() << " GHz" << endl;
+    } else {
+        cout << "FastClock: no invariant TSC, using steady_clock" << endl;
+    }
+    auto steadyStart = chrono::steady_clock::now();
+    uint64_t fastStart = FastClock::now();
+    cout << "  steady_clock::now       "
+         << nanosPerRead(reads, []() { return chrono::steady_clock::now().time_since_epoch().count(); })
+         << " ns/read" << endl;
+    cout << "  FastClock::now          " << nanosPerRead(reads, []() { return FastClock::now(); })
+         << " ns/read" << endl;
+    cout << "  time() (stay minutes)   " << nanosPerRead(reads, []() { return time(nullptr); })
+         << " ns/read" << endl;
+#ifdef CLOCK_MONOTONIC_COARSE
+    timespec resolution;
+    clock_getres(CLOCK_MONOTONIC_COARSE, &resolution);
+    cout << "  CLOCK_MONOTONIC_COARSE  " << nanosPerRead(reads, []() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_nsec;
+    }) << " ns/read (ticks every " << resolution.tv_nsec / 1e6 << " ms)" << endl;
+#endif
+    double steadyNs = chrono::duration<double, nano>(chrono::steady_clock::now() - steadyStart).count();
+    double fastNs = double(FastClock::toNanos(FastClock::now() - fastStart));
+    cout << "FastClock vs steady_clock over the run: " << (fastNs - steadyNs) / steadyNs * 100 << "%" << endl;
+}
+
+///////////////////////////////////////////////////////////
+// PerfCounters: Hardware counters for the calling thread through
+// perf_event_open (cycles, instructions, cache misses, branch misses),
+// read together as one group. Where the kernel or the machine doesn't
+// offer them, available() is false and only wall time is measured.
+///////////////////////////////////////////////////////////
+const int kPerfEvents = 4;
+const char* const kPerfEventNames[kPerfEvents] = {"cycles", "instr", "cache-miss", "branch-miss"};
+
+struct CounterReading {
+    uint64_t values[kPerfEvents] = {0, 0, 0, 0};  // In kPerfEventNames order
+    uint64_t nanos = 0;
+};
+
+class PerfCounters {
+public:
+    PerfCounters() : leader(-1), startTicks(0) {
+#ifdef __linux__
+        const uint64_t configs[kPerfEvents] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                               PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < kPerfEvents; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = (i == 0);  // The group starts with its leader
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : leader, 0));
+            if (fd < 0) {
+                failure = string("perf_event_open: ") + strerror(errno);
+                closeAll();
                 return;
             }
+            fds.push_back(fd);
+            if (i == 0) leader = fd;
         }
-        cout << "The garage is completely full." << endl;
+#else
+        failure = "hardware counters need Linux";
+#endif
     }
 
-    // Locate a machine by its ID, and display its type as well.
-    void locateMachine(const string& machineId) {
-        lock_guard<mutex> lock(garageMutex);
-        // See if it's recorded.
-        if (!machineLocations.count(machineId)) {
-            cout << "Could not find machine ID " << machineId << " in the garage." << endl;
-            return;
+    ~PerfCounters() { closeAll(); }
+
+    bool available() const { return leader >= 0; }
+    const string& whyUnavailable() const { return failure; }
+
+    void start() {
+#ifdef __linux__
+        if (available()) {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+        startTicks = FastClock::now();
+    }
+
+    CounterReading stop() {
+        uint64_t ticks = FastClock::now() - startTicks;
+        CounterReading reading;
+#ifdef __linux__
+        if (available()) {
+            ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            uint64_t group[1 + kPerfEvents];  // Event count, then each value
+            if (read(leader, group, sizeof(group)) == ssize_t(sizeof(group))) {
+                copy(group + 1, group + 1 + kPerfEvents, reading.values);
+            }
         }
-        auto& entry = machineLocations[machineId];
-        int lvlIndex = entry.first;
-        vector<int> slots = entry.second;
+#endif
+        reading.nanos = FastClock::toNanos(ticks);
+        return reading;
+    }
 
-        // Retrieve the machine object from our catalog.
-        // This is safe because we only store machineLocations if we also store in machineCatalog.
-        auto& theMachine = machineCatalog[machineId];
-        string typeName = kindToString(theMachine.kind);
+private:
+    int leader;
+    vector<int> fds;
+    string failure;
+    uint64_t startTicks;
 
-        cout << "Machine '" << machineId << "' (" << typeName << ") is on Level " << lvlIndex << " occupying slot(s): ";
-        for (int s : slots) cout << s << " ";
-        cout << endl;
+    void closeAll() {
+        for (int fd : fds) close(fd);
+        fds.clear();
+        leader = -1;
     }
 };
 
 ///////////////////////////////////////////////////////////
-// Main function: A simple interface for our "Garage" system.
+// Counter bench: Runs the allocator's hot functions and the plate
+// lookups under PerfCounters on a level laid out empty, full or
+// fragmented (a random half occupied), and reports counts per call.
+// Each counter window wraps a batch of calls so the ioctls around it
+// don't swamp what is measured.
 ///////////////////////////////////////////////////////////
-int main() {
-    // Let's ask the user how many levels and how many slots per level.
-    int levelCount, slotsPerLevel;
-    cout << "Number of levels inyour parking lot garage: ";
-    cin >> levelCount;
-    cout << "Number of slots/spots on each level: ";
-    cin >> slotsPerLevel;
+const int kCounterBenchBatch = 1000;
 
-    // Create the garage with the specified dimensions.
-    Garage myGarage(levelCount, slotsPerLevel);
+static void printCounterRow(const string& name, const CounterReading& r, size_t calls, bool counters) {
+    if (calls == 0) return;
+    cout << "  " << name;
+    for (size_t pad = name.size(); pad < 24; ++pad) cout << ' ';
+    if (counters) {
+        for (int e = 0; e < kPerfEvents; ++e) cout << kPerfEventNames[e] << " " << double(r.values[e]) / calls << "\t";
+    }
+    cout << "ns " << double(r.nanos) / calls << endl;
+}
+
+static void runCounterBench(int slotCount, unsigned seed) {
+    PerfCounters counters;
+    cout << "\n=== Counter Bench (" << slotCount << " slots, per call) ===" << endl;
+    if (!counters.available()) cout << "No hardware counters (" << counters.whyUnavailable() << "); wall time only." << endl;
+    const char* patterns[] = {"empty", "full", "fragmented"};
+    for (int pattern = 0; pattern < 3; ++pattern) {
+        mt19937 rng(seed);
+        vector<Level> levels;
+        FlatLevelStore store;
+        store.addLevel(levels, slotCount, kBikeBaysPerSlot);
+        Level& lvl = levels[0];
+        IdTable ids;
+        vector<Machine> parked, absent;
+        for (int i = 0; i < slotCount; ++i) {
+            Machine m("CB" + to_string(i), MachineKind::Car);
+            m.handle = ids.intern(m.identifier);
+            if (pattern == 1 || (pattern == 2 && rng() % 2)) {
+                lvl.assignMachine(m, {i});
+                parked.push_back(m);
+            } else {
+                absent.push_back(m);
+            }
+        }
+        cout << patterns[pattern] << " (" << parked.size() << " parked):" << endl;
+
+        size_t sink = 0;
+        Machine car("probe", MachineKind::Car), truck("probe", MachineKind::Truck);
+        counters.start();
+        for (int i = 0; i < kCounterBenchBatch; ++i) sink += lvl.spotsAvailable(car).size();
+        printCounterRow("spotsAvailable(Car)", counters.stop(), kCounterBenchBatch, counters.available());
+        counters.start();
+        for (int i = 0; i < kCounterBenchBatch; ++i) sink += lvl.spotsAvailable(truck).size();
+        printCounterRow("spotsAvailable(Truck)", counters.stop(), kCounterBenchBatch, counters.available());
+
+        // Plate lookups: parked plates hit, made-up plates miss.
+        vector<string> hits, misses;
+        for (int i = 0; i < kCounterBenchBatch; ++i) {
+            if (!parked.empty()) hits.push_back(parked[rng() % parked.size()].identifier);
+            misses.push_back("NX" + to_string(rng()));
+        }
+        counters.start();
+        for (const string& plate : hits) sink += ids.find(plate);
+        printCounterRow("IdTable::find (hit)", counters.stop(), hits.size(), counters.available());
+        counters.start();
+        for (const string& plate : misses) sink += ids.find(plate);
+        printCounterRow("IdTable::find (miss)", counters.stop(), misses.size(), counters.available());
+
+        // Park and unpark a batch of cars: into free slots when there are
+        // any, otherwise out of occupied ones and back.
+        shuffle(absent.begin(), absent.end(), rng);
+        shuffle(parked.begin(), parked.end(), rng);
+        vector<Machine>& batch = absent.empty() ? parked : absent;
+        if (batch.size() > size_t(kCounterBenchBatch)) batch.resize(kCounterBenchBatch);
+        vector<vector<int>> slots;
+        for (const Machine& m : batch) slots.push_back({atoi(m.identifier.c_str() + 2)});
+        CounterReading assigned, removed;
+        if (&batch == &absent) {
+            counters.start();
+            for (size_t i = 0; i < batch.size(); ++i) sink += lvl.assignMachine(batch[i], slots[i]);
+            assigned = counters.stop();
+            counters.start();
+            for (size_t i = 0; i < batch.size(); ++i) sink += lvl.removeMachine(batch[i].handle, slots[i]);
+            removed = counters.stop();
+        } else {
+            counters.start();
+            for (size_t i = 0; i < batch.size(); ++i) sink += lvl.removeMachine(batch[i].handle, slots[i]);
+            removed = counters.stop();
+            counters.start();
+            for (size_t i = 0; i < batch.size(); ++i) sink += lvl.assignMachine(batch[i], slots[i]);
+            assigned = counters.stop();
+        }
+        printCounterRow("assignMachine", assigned, batch.size(), counters.available());
+        printCounterRow("removeMachine", removed, batch.size(), counters.available());
+        volatile size_t keep = sink;  // Keep the calls from being optimized away
+        (void)keep;
+    }
+}
+
+///////////////////////////////////////////////////////////
+// LatencyHistogram: Counts samples in power-of-two ranges of
+// nanoseconds, each split into 4 sub-buckets so quantiles come out
+// within 25%. Recording is a bit scan and an increment, so it can sit
+// around every operation of a fill.
+///////////////////////////////////////////////////////////
+const int kLatencyOctaves = 40;
+
+// Short human-readable duration, e.g. "512 ns", "4 us", "16 ms".
+static string formatNanos(uint64_t ns) {
+    if (ns < 1000) return to_string(ns) + " ns";
+    if (ns < 1000000) return to_string(ns / 1000) + " us";
+    return to_string(ns / 1000000) + " ms";
+}
+
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts(kLatencyOctaves * 4, 0), samples(0), worst(0) {}
+
+    void record(uint64_t ns) {
+        counts[bucketOf(ns)]++;
+        samples++;
+        worst = max(worst, ns);
+    }
+
+    uint64_t count() const { return samples; }
+    uint64_t maxNs() const { return worst; }
+
+    // Upper edge of the bucket holding quantile q (0..1).
+    uint64_t percentileNs(double q) const {
+        uint64_t target = uint64_t(q * samples);
+        uint64_t seen = 0;
+        for (size_t b = 0; b < counts.size(); ++b) {
+            seen += counts[b];
+            if (seen > target) return upperEdge(int(b));
+        }
+        return worst;
+    }
+
+    // One line per non-empty power-of-two range, bar scaled to the largest.
+    void print(ostream& out) const {
+        vector<uint64_t> octaves(kLatencyOctaves, 0);
+        for (size_t b = 0; b < counts.size(); ++b) {
+            octaves[b < 4 ? (b < 2 ? 0 : 1) : b / 4] += counts[b];
+        }
+        uint64_t largest = *max_element(octaves.begin(), octaves.end());
+        for (int o = 0; o < kLatencyOctaves; ++o) {
+            if (!octaves[o]) continue;
+            size_t bar = size_t(1 + 39 * octaves[o] / largest);
+            out << "  < " << formatNanos(uint64_t(1) << (o + 1)) << "\t" << octaves[o] << "\t"
+                << string(bar, '#') << endl;
+        }
+    }
+
+private:
+    vector<uint64_t> counts;   // 4 per octave; values below 4 ns get one each
+    uint64_t samples;
+    uint64_t worst;
+
+    static int bucketOf(uint64_t ns) {
+        if (ns < 4) return int(ns);
+        int octave = min(highestSetBit(ns), kLatencyOctaves - 1);
+        return octave * 4 + int((ns >> (octave - 2)) & 3);
+    }
+
+    static uint64_t upperEdge(int bucket) {
+        if (bucket < 4) return uint64_t(bucket + 1);
+        return uint64_t(4 + bucket % 4 + 1) << (bucket / 4 - 2);
+    }
+};
+
+///////////////////////////////////////////////////////////
+// Registry fill: Interns plates from empty up to count, timing every
+// insert and one lookup of an already-interned plate after each. The
+// same fill through an unordered_map shows the stall its rehashes cause.
+///////////////////////////////////////////////////////////
+struct FillLatency {
+    LatencyHistogram inserts;
+    LatencyHistogram lookups;
+    double totalMs = 0;
+};
+
+template <typename Insert, typename Lookup>
+static FillLatency timeFill(const vector<string>& plates, unsigned seed, Insert insert, Lookup lookup) {
+    FillLatency result;
+    mt19937 rng(seed);
+    auto fillStart = chrono::steady_clock::now();
+    for (size_t i = 0; i < plates.size(); ++i) {
+        uint64_t t0 = FastClock::now();
+        insert(plates[i]);
+        uint64_t t1 = FastClock::now();
+        lookup(plates[rng() % (i + 1)]);
+        uint64_t t2 = FastClock::now();
+        result.inserts.record(FastClock::toNanos(t1 - t0));
+        result.lookups.record(FastClock::toNanos(t2 - t1));
+    }
+    result.totalMs = chrono::duration<double, milli>(chrono::steady_clock::now() - fillStart).count();
+    return result;
+}
+
+static void printFill(const string& name, const FillLatency& fill) {
+    cout << name << ": total " << fill.totalMs << " ms" << endl;
+    cout << "  insert p99 < " << formatNanos(fill.inserts.percentileNs(0.99)) << ", max "
+         << formatNanos(fill.inserts.maxNs()) << "; lookup p99 < "
+         << formatNanos(fill.lookups.percentileNs(0.99)) << ", max " << formatNanos(fill.lookups.maxNs()) << endl;
+    cout << "  Insert latency:" << endl;
+    fill.inserts.print(cout);
+}
+
+static void runRegistryFill(long long count, unsigned seed) {
+    vector<string> plates;
+    plates.reserve(count);
+    for (long long i = 0; i < count; ++i) plates.push_back("PL" + to_string(i));
+
+    IdTable table;
+    size_t found = 0;
+    FillLatency cuckoo = timeFill(plates, seed,
+        [&](const string& p) { table.intern(p); },
+        [&](const string& p) { found += table.find(p) != kNoHandle; });
+
+    unordered_map<string, uint32_t> baseline;
+    FillLatency chained = timeFill(plates, seed,
+        [&](const string& p) { baseline.emplace(p, uint32_t(baseline.size())); },
+        [&](const string& p) { found += baseline.count(p); });
+
+    cout << "\n=== Registry Fill (IdTable vs unordered_map) ===" << endl;
+    cout << "Plates: " << count << ", index resizes: " << table.resizeCount() << endl;
+    printFill("IdTable", cuckoo);
+    printFill("unordered_map", chained);
+    if (found != size_t(count) * 2) cout << "Result: FAIL (a lookup missed)" << endl;
+}
+
+///////////////////////////////////////////////////////////
+// Load scenarios: A scenario file describes a day as timed phases:
+//     levels 6
+//     slots 16384
+//     plates 120000
+//     seed 11
+//     phase 180 arrive=600 depart=40 locate=100 reserve=5 mix=10/85/5
+// Each phase runs for the given number of simulated minutes. Every
+// minute it makes that many arrivals, departures, lookups and
+// reservations (interleaved at random) against a quiet Garage, then
+// moves the garage clock on, so the forecaster sees the day as well.
+// mix is the bike/car/truck percentage of arriving machines.
+///////////////////////////////////////////////////////////
+struct ScenarioPhase {
+    int minutes = 0;
+    int arrive = 0, depart = 0, locate = 0, reserve = 0;
+    int bikePct = 10, carPct = 85;  // Trucks get the rest
+};
+
+struct Scenario {
+    string name;
+    int levels = 1;
+    int slots = 64;
+    int plates = 1000;
+    unsigned seed = 1;
+    vector<ScenarioPhase> phases;
+};
+
+struct ScenarioResult {
+    long long ops = 0;
+    double opsPerSec = 0;
+    uint64_t p99Ns = 0;
+};
+
+// Parse "name=value" into value when setting starts with name=.
+// matched says whether it did, even if the value then failed to parse.
+static bool parseSetting(const string& setting, const string& name, long long lo, long long hi,
+                         int& value, bool& matched) {
+    matched = setting.compare(0, name.size() + 1, name + "=") == 0;
+    long long number;
+    if (!matched || !parseWholeInt(setting.substr(name.size() + 1), lo, hi, number)) return false;
+    value = int(number);
+    return true;
+}
+
+static bool loadScenario(const string& path, Scenario& scenario, string& error) {
+    ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    string line;
+    for (int lineNo = 1; getline(in, line); ++lineNo) {
+        istringstream fields(line);
+        string key, value;
+        if (!(fields >> key) || key[0] == '#') continue;
+        fields >> value;  // Left empty if missing, which no parser accepts
+        bool ok = true;
+        long long number = 0;
+        if (key == "levels") {
+            ok = parseWholeInt(value, 1, kMaxConfigValue, number);
+            scenario.levels = int(number);
+        } else if (key == "slots") {
+            ok = parseWholeInt(value, 1, kMaxConfigValue, number);
+            scenario.slots = int(number);
+        } else if (key == "plates") {
+            ok = parseWholeInt(value, 1, kMaxConfigValue, number);
+            scenario.plates = int(number);
+        } else if (key == "seed") {
+            ok = parseWholeInt(value, 0, UINT32_MAX, number);
+            scenario.seed = unsigned(number);
+        } else if (key == "phase") {
+            ScenarioPhase phase;
+            ok = parseWholeInt(value, 1, kMaxConfigValue, number);
+            phase.minutes = int(number);
+            string setting;
+            while (ok && fields >> setting) {
+                bool matched = false;
+                int* counts[] = {&phase.arrive, &phase.depart, &phase.locate, &phase.reserve};
+                const char* names[] = {"arrive", "depart", "locate", "reserve"};
+                for (int i = 0; i < 4 && !matched; ++i) {
+                    ok = parseSetting(setting, names[i], 0, kMaxConfigValue, *counts[i], matched);
+                }
+                if (matched) continue;
+                // mix=bike/car/truck percentages adding up to 100.
+                long long pct[3];
+                size_t cut1 = setting.find('/'), cut2 = setting.find('/', cut1 + 1);
+                ok = setting.compare(0, 4, "mix=") == 0 && cut1 != string::npos && cut2 != string::npos &&
+                     parseWholeInt(setting.substr(4, cut1 - 4), 0, 100, pct[0]) &&
+                     parseWholeInt(setting.substr(cut1 + 1, cut2 - cut1 - 1), 0, 100, pct[1]) &&
+                     parseWholeInt(setting.substr(cut2 + 1), 0, 100, pct[2]) &&
+                     pct[0] + pct[1] + pct[2] == 100;
+                if (ok) {
+                    phase.bikePct = int(pct[0]);
+                    phase.carPct = int(pct[1]);
+                }
+            }
+            scenario.phases.push_back(phase);
+        } else {
+            ok = false;
+        }
+        string extra;
+        if (!ok || (key != "phase" && fields >> extra)) {
+            error = path + ":" + to_string(lineNo) + ": cannot parse '" + line + "'";
+            return false;
+        }
+    }
+    if (scenario.phases.empty()) {
+        error = path + " has no phases";
+        return false;
+    }
+    return true;
+}
+
+static ScenarioResult runScenario(const Scenario& scenario) {
+    // The scenario tracks what it parked itself, so turned-away drivers leave.
+    GarageConfig config;
+    config.slotCounts.assign(scenario.levels, scenario.slots);
+    config.waitlistLimit = 0;
+    Garage garage(config);
+    NullStream quiet;
+    garage.setConsole(quiet);
+    mt19937 rng(scenario.seed);
+    vector<string> plates;
+    for (int i = 0; i < scenario.plates; ++i) plates.push_back("S" + to_string(i));
+    vector<string> parked, reserved;
+    LatencyHistogram latency;
+    ScenarioResult result;
+
+    auto pickKind = [&](const ScenarioPhase& phase) {
+        int roll = int(rng() % 100);
+        if (roll < phase.bikePct) return MachineKind::Bike;
+        return roll < phase.bikePct + phase.carPct ? MachineKind::Car : MachineKind::Truck;
+    };
+    auto takeRandom = [&](vector<string>& from) {
+        size_t pick = rng() % from.size();
+        string plate = move(from[pick]);
+        from[pick] = move(from.back());
+        from.pop_back();
+        return plate;
+    };
+
+    auto start = chrono::steady_clock::now();
+    for (const ScenarioPhase& phase : scenario.phases) {
+        for (int minute = 0; minute < phase.minutes; ++minute) {
+            int left[4] = {phase.arrive, phase.depart, phase.locate, phase.reserve};
+            for (int remaining = left[0] + left[1] + left[2] + left[3]; remaining > 0; --remaining) {
+                // Pick the next operation in proportion to what's left this minute.
+                int roll = int(rng() % remaining), op = 0;
+                while (roll >= left[op]) roll -= left[op++];
+                left[op]--;
+                uint64_t t0 = FastClock::now();
+                if (op == 0) {
+                    // A reserved machine turning up commits its reservation.
+                    bool expected = !reserved.empty() && rng() % 2;
+                    string plate = expected ? takeRandom(reserved) : plates[rng() % plates.size()];
+                    if (garage.storeMachine(Machine(plate, expected ? MachineKind::Car : pickKind(phase)))) {
+                        parked.push_back(plate);
+                    }
+                } else if (op == 1) {
+                    if (!parked.empty()) garage.unparkMachine(takeRandom(parked));
+                } else if (op == 2) {
+                    garage.locateMachine(plates[rng() % plates.size()]);
+                } else {
+                    string plate = plates[rng() % plates.size()];
+                    if (garage.reserveMachine(Machine(plate, MachineKind::Car))) reserved.push_back(plate);
+                }
+                latency.record(FastClock::toNanos(FastClock::now() - t0));
+            }
+            garage.advanceClock(1);
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    result.ops = static_cast<long long>(latency.count());
+    result.opsPerSec = seconds > 0 ? result.ops / seconds : 0;
+    result.p99Ns = latency.percentileNs(0.99);
+    return result;
+}
+
+///////////////////////////////////////////////////////////
+// Perf regression: Runs every *.scn file in a directory and compares
+// ops/sec and p99 latency with the directory's baseline.txt. A scenario
+// regresses when it is slower or its p99 higher than the baseline by
+// more than the tolerance.
+//
+// The baseline is recorded on the machine doing the comparing
+// (perf_baseline) and is not checked in. Every scenario run is paired
+// with a calibration run, a fixed sort-and-hash workload that shares no
+// code with the garage, and its results are scaled to the baseline's
+// calibration rate. The medians of kPerfRuns such runs are compared, so
+// a host that is busier now than when the baseline was recorded, or one
+// noisy run, isn't reported as a regression.
+//
+//   calibration <rate>
+//   <name> <ops_per_sec> <p99_ns>     one line per scenario, at that rate
+///////////////////////////////////////////////////////////
+const int kPerfRuns = 5;
+
+// Median of a few samples.
+template <typename T>
+static T medianOf(vector<T> values) {
+    nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+// How fast this host runs the calibration workload right now, in
+// elements per second.
+static double measureCalibration() {
+    const size_t n = 1 << 18;
+    mt19937 rng(7);
+    vector<uint32_t> values(n);
+    for (auto& v : values) v = rng();
+    auto start = chrono::steady_clock::now();
+    sort(values.begin(), values.end());
+    unordered_map<uint32_t, uint32_t> counts;
+    for (size_t i = 0; i < n; i += 4) counts[values[i] >> 8]++;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return seconds > 0 ? (n + counts.size()) / seconds : 0;
+}
+
+// Median ops/sec and median p99 over kPerfRuns runs of a scenario, each
+// scaled to what it would be at the given calibration rate.
+static ScenarioResult runScenarioMedian(const Scenario& scenario, double atCalibration) {
+    vector<double> rates;
+    vector<double> p99s;
+    ScenarioResult result;
+    for (int run = 0; run < kPerfRuns; ++run) {
+        double before = measureCalibration();
+        ScenarioResult r = runScenario(scenario);
+        // Above 1 the host is running faster than at atCalibration.
+        double hostScale = (before + measureCalibration()) / 2 / atCalibration;
+        rates.push_back(r.opsPerSec / hostScale);
+        p99s.push_back(r.p99Ns * hostScale);
+        result.ops = r.ops;
+    }
+    result.opsPerSec = medianOf(rates);
+    result.p99Ns = uint64_t(medianOf(p99s));
+    return result;
+}
+
+static void runPerfRegression(const string& dir, double tolerance, bool recordBaseline) {
+    vector<string> names;
+    if (DIR* handle = opendir(dir.c_str())) {
+        while (dirent* entry = readdir(handle)) {
+            string file = entry->d_name;
+            if (file.size() > 4 && file.compare(file.size() - 4, 4, ".scn") == 0) {
+                names.push_back(file.substr(0, file.size() - 4));
+            }
+        }
+        closedir(handle);
+    }
+    sort(names.begin(), names.end());
+    if (names.empty()) {
+        cout << "No scenario (.scn) files in " << dir << "." << endl;
+        return;
+    }
+
+    unordered_map<string, ScenarioResult> baseline;
+    double baseCalibration = 0;
+    ifstream baseIn(dir + "/baseline.txt");
+    string baseName;
+    ScenarioResult baseResult;
+    if (!recordBaseline && !(baseIn >> baseName >> baseCalibration && baseName == "calibration" &&
+                             baseCalibration > 0)) {
+        cout << "No baseline for this machine in " << dir << "; run perf_baseline " << dir
+             << " on it first." << endl;
+        return;
+    }
+    while (baseIn >> baseName >> baseResult.opsPerSec >> baseResult.p99Ns) baseline[baseName] = baseResult;
+
+    cout << "\n=== Perf Regression (" << dir;
+    if (recordBaseline) cout << ", recording baseline) ===" << endl;
+    else cout << ", tolerance " << tolerance * 100 << "%, median of " << kPerfRuns << " runs) ===" << endl;
+    if (recordBaseline) {
+        vector<double> rates;
+        for (int run = 0; run < kPerfRuns; ++run) rates.push_back(measureCalibration());
+        baseCalibration = medianOf(rates);
+    }
+    ostringstream newBaseline;
+    newBaseline << "calibration " << static_cast<long long>(baseCalibration) << "\n";
+    bool regressed = false;
+    for (const string& name : names) {
+        Scenario scenario;
+        string error;
+        if (!loadScenario(dir + "/" + name + ".scn", scenario, error)) {
+            cout << name << ": " << error << endl;
+            regressed = true;
+            continue;
+        }
+        ScenarioResult r = runScenarioMedian(scenario, baseCalibration);
+        newBaseline << name << " " << static_cast<long long>(r.opsPerSec) << " " << r.p99Ns << "\n";
+        cout << name << ": " << r.ops << " ops, " << static_cast<long long>(r.opsPerSec)
+             << " ops/sec, p99 < " << formatNanos(r.p99Ns);
+        auto base = baseline.find(name);
+        if (recordBaseline) {
+            cout << endl;
+        } else if (base == baseline.end()) {
+            cout << "  (no baseline)" << endl;
+        } else {
+            bool slower = r.opsPerSec < base->second.opsPerSec * (1 - tolerance);
+            bool laggier = r.p99Ns > base->second.p99Ns * (1 + tolerance);
+            cout << "  vs " << static_cast<long long>(base->second.opsPerSec) << " ops/sec, p99 < "
+                 << formatNanos(base->second.p99Ns) << (slower || laggier ? "  REGRESSED" : "  ok") << endl;
+            regressed = regressed || slower || laggier;
+        }
+    }
+    if (recordBaseline) {
+        ofstream out(dir + "/baseline.txt");
+        out << newBaseline.str();
+        cout << (out ? "Baseline written to " + dir + "/baseline.txt." : "Could not write the baseline.") << endl;
+    } else {
+        cout << "Result: " << (regressed ? "REGRESSED" : "PASS") << endl;
+    }
+}
+
+///////////////////////////////////////////////////////////
+// CameraDedup: Drops repeated camera reads before they reach the
+// garage. ANPR cameras fire several reads per passing vehicle, so a
+// read of the same plate at the same gate within the window is a
+// duplicate. Keys sit in one-second buckets in a ring covering the
+// window, and each second that passes forgets its oldest bucket.
+///////////////////////////////////////////////////////////
+const int kDedupWindowSeconds = 10;
+
+class CameraDedup {
+public:
+    explicit CameraDedup(int windowSeconds = kDedupWindowSeconds)
+        : buckets(windowSeconds + 1), currentSecond(-1), passed(0), dropped(0) {}
+
+    // True if the read should go on to the garage, false if the same
+    // key was already let through within the window.
+    bool admit(const string& key, long long second) {
+        advanceTo(second);
+        if (!lastSeen.emplace(key, currentSecond).second) {
+            dropped++;
+            return false;
+        }
+        buckets[currentSecond % buckets.size()].push_back(key);
+        passed++;
+        return true;
+    }
+
+    long long passedCount() const { return passed; }
+    long long droppedCount() const { return dropped; }
+
+private:
+    vector<vector<string>> buckets;           // Keys let through, by second
+    unordered_map<string, long long> lastSeen; // Key -> second it was let through
+    long long currentSecond;
+    long long passed;
+    long long dropped;
+
+    // Forget buckets that fell out of the window; everything after a long gap.
+    void advanceTo(long long second) {
+        if (currentSecond < 0) currentSecond = second;
+        long long steps = min<long long>(second - currentSecond, buckets.size());
+        for (long long i = 1; i <= steps; ++i) {
+            vector<string>& expired = buckets[(currentSecond + i) % buckets.size()];
+            for (const string& key : expired) lastSeen.erase(key);
+            expired.clear();
+        }
+        if (second > currentSecond) currentSecond = second;
+    }
+};
+
+// The dedup key: which gate saw which plate.
+static string cameraKey(const string& gate, const string& plate) {
+    return gate + ":" + plate;
+}
+
+///////////////////////////////////////////////////////////
+// Camera benchmark: Feeds a synthetic stream of gate reads through
+// CameraDedup on one thread. Vehicles pass at the given rate and each
+// pass fires one to five reads over the next two seconds.
+///////////////////////////////////////////////////////////
+static void runCameraBench(long long events, unsigned seed) {
+    const long long kPassesPerSecond = 30000;  // With ~3 reads each, ~100k reads/sec
+    mt19937 rng(seed);
+    struct Read {
+        long long second;
+        string key;
+    };
+    vector<Read> stream;
+    stream.reserve(events);
+    long long passes = 0;
+    while (static_cast<long long>(stream.size()) < events) {
+        long long second = passes / kPassesPerSecond;
+        string key = cameraKey(rng() % 2 ? "in" : "out", "C" + to_string(rng() % 5000000));
+        int reads = 1 + int(rng() % 5);
+        for (int r = 0; r < reads && static_cast<long long>(stream.size()) < events; ++r) {
+            stream.push_back({second + (r * 2) / reads, key});
+        }
+        passes++;
+    }
+    // Reads from neighbouring passes interleave a little, as at a real gate.
+    for (size_t i = 1; i < stream.size(); ++i) {
+        if (stream[i - 1].second == stream[i].second && rng() % 4 == 0) swap(stream[i - 1], stream[i]);
+    }
+
+    CameraDedup dedup;
+    auto start = chrono::steady_clock::now();
+    for (const Read& read : stream) dedup.admit(read.key, read.second);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "\n=== Camera Dedup ===" << endl;
+    cout << stream.size() << " read(s) from " << passes << " pass(es): " << dedup.passedCount()
+         << " passed, " << dedup.droppedCount() << " dropped as duplicates" << endl;
+    if (seconds > 0) {
+        cout << "Throughput: " << static_cast<long long>(stream.size() / seconds) << " reads/sec on one thread ("
+             << seconds * 1e9 / stream.size() << " ns/read)" << endl;
+    }
+}
+
+///////////////////////////////////////////////////////////
+// Hot restart: Replaces the running program with a new binary without
+// losing state. The garage writes a handoff image into a memfd, which
+// the new binary inherits across exec along with stdin and stdout, so
+// it picks up the very next command. Commands are handled one at a
+// time, so the one that asked for the restart is the last one drained.
+///////////////////////////////////////////////////////////
+static long long steadyNanos() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool writeAll(int fd, const string& data) {
+    for (size_t done = 0; done < data.size(); ) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += size_t(n);
+    }
+    return true;
+}
+
+// Only returns if the new binary could not be started.
+static void hotRestart(Garage& myGarage, const string& binary) {
+    long long started = steadyNanos();
+    int fd = memfd_create("garage-handoff", 0);  // No MFD_CLOEXEC: the new binary inherits it
+    if (fd < 0) {
+        cout << "Could not create the handoff memfd: " << strerror(errno) << "." << endl;
+        return;
+    }
+    ostringstream image;
+    if (!myGarage.writeHandoff(image, started) || !writeAll(fd, image.str())) {
+        cout << "Could not write the handoff image." << endl;
+    } else {
+        string fdArg = to_string(fd);
+        char* args[] = {const_cast<char*>(binary.c_str()), const_cast<char*>("--handoff"),
+                        const_cast<char*>(fdArg.c_str()), nullptr};
+        cout.flush();
+        execv(binary.c_str(), args);
+        cout << "Could not start " << binary << ": " << strerror(errno) << "." << endl;
+    }
+    close(fd);
+    myGarage.cancelHandoff();
+    cout << "Still running; nothing was handed off." << endl;
+}
+
+// Read the handoff image from fd into a fresh garage.
+static bool resumeHandoff(Garage& myGarage, int fd, long long& started, string& error) {
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        error = "cannot read handoff fd " + to_string(fd);
+        return false;
+    }
+    string data(size_t(info.st_size), '\0');
+    for (size_t done = 0; done < data.size(); ) {
+        ssize_t n = pread(fd, &data[done], data.size() - done, off_t(done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            error = "short handoff image";
+            return false;
+        }
+        done += size_t(n);
+    }
+    close(fd);
+    istringstream in(data);
+    return myGarage.takeOver(in, started, error);
+}
+
+// Read a command's numeric arguments. A token that isn't a number is
+// reported and the rest of its line dropped, so cin stays usable for the
+// next command instead of ending the session.
+template <typename... T>
+static bool readNumbers(T&... values) {
+    bool ok = true;
+    ((ok = ok && bool(cin >> values)), ...);
+    if (ok) return true;
+    cin.clear();
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    cout << "Expected a number there; type 'commands' for usage." << endl;
+    return false;
+}
 
+///////////////////////////////////////////////////////////
+// Command loop: Reads commands until quit. slotCounts sizes the
+// scratch garage used by stress_test.
+///////////////////////////////////////////////////////////
+static int runCommandLoop(Garage& myGarage, const vector<int>& slotCounts) {
     cout << "\nWelcome to the Garage System!" << endl;
+    // Camera reads pass through here first, so duplicates never take the garage lock.
+    CameraDedup cameras;
     // Show the user what commands are available.
     myGarage.showAllCommands();
 
@@ -308,7 +4843,7 @@ int main() {
     while (true) {
         cout << "\nEnter command: ";
         string cmd;
-        cin >> cmd;
+        if (!(cin >> cmd)) break;  // Input closed
 
         if (cmd == "add_machine") {
             // Example usage: add_machine ABC123 Car
@@ -316,20 +4851,80 @@ int main() {
             cin >> id >> kindStr;
 
             // We'll interpret the second argument as the machine kind.
-            MachineKind mk;
-            if (kindStr == "Bike")      mk = MachineKind::Bike;
-            else if (kindStr == "Car")  mk = MachineKind::Car;
-            else                         mk = MachineKind::Truck;
-
-            Machine newMachine(id, mk);
+            Machine newMachine(id, kindFromString(kindStr));
             myGarage.storeMachine(newMachine);
+        } else if (cmd == "camera") {
+            // Example usage: camera in ABC123 Car (or camera out ABC123)
+            string gate, id, kindStr;
+            cin >> gate;
+            if (gate != "in" && gate != "out") {
+                string rest;
+                getline(cin, rest);
+                cout << "Unknown gate '" << gate << "'; use camera in <id> <kind> or camera out <id>." << endl;
+                continue;
+            }
+            cin >> id;
+            if (gate == "in") cin >> kindStr;
+            if (!cameras.admit(cameraKey(gate, id), static_cast<long long>(time(nullptr)))) {
+                cout << "Duplicate read of " << id << " at the " << gate << " gate dropped." << endl;
+            } else if (gate == "in") {
+                myGarage.storeMachine(Machine(id, kindFromString(kindStr)));
+            } else {
+                myGarage.unparkMachine(id);
+            }
+        } else if (cmd == "reserve_machine") {
+            // Example usage: reserve_machine BUS42 Truck
+            string id, kindStr;
+            cin >> id >> kindStr;
+            myGarage.reserveMachine(Machine(id, kindFromString(kindStr)));
+        } else if (cmd == "cancel_reservation") {
+            // Example usage: cancel_reservation BUS42
+            string id;
+            cin >> id;
+            myGarage.cancelReservation(id);
         } else if (cmd == "unpark_machine") {
             // Example usage: unpark_machine ABC123
             string id;
             cin >> id;
             myGarage.unparkMachine(id);
+        } else if (cmd == "waitlist") {
+            myGarage.showWaitlist();
+        } else if (cmd == "leave_waitlist") {
+            // Example usage: leave_waitlist ABC123
+            string id;
+            cin >> id;
+            myGarage.leaveWaitlist(id);
         } else if (cmd == "check_availability") {
             myGarage.checkAvailability();
+        } else if (cmd == "show_map") {
+            myGarage.showMap();
+        } else if (cmd == "dashboard") {
+            // Example usage: dashboard diff
+            string mode;
+            cin >> mode;
+            myGarage.renderDashboard(mode == "ansi" ? DashboardMode::Terminal
+                                                    : DashboardMode::DiffRecords);
+        } else if (cmd == "forecast") {
+            myGarage.showForecast();
+        } else if (cmd == "metrics") {
+            // Example usage: metrics 5
+            int minutes;
+            if (!readNumbers(minutes)) continue;
+            if (minutes < 1 || minutes > kTrafficMinutes) {
+                cout << "The window must be 1 to " << kTrafficMinutes << " minute(s)." << endl;
+                continue;
+            }
+            myGarage.showMetrics(minutes);
+        } else if (cmd == "advance_clock") {
+            // Example usage: advance_clock 15
+            long long minutes;
+            if (!readNumbers(minutes)) continue;
+            if (myGarage.advanceClock(minutes)) {
+                cout << "Clock moved forward " << minutes << " minute(s)." << endl;
+            } else {
+                cout << "The clock only moves forward, by at most " << kMaxClockSkewMinutes
+                     << " minute(s) in total." << endl;
+            }
         } else if (cmd == "check_full") {
             myGarage.checkIfFull();
         } else if (cmd == "locate_machine") {
@@ -337,6 +4932,167 @@ int main() {
             string id;
             cin >> id;
             myGarage.locateMachine(id);
+        } else if (cmd == "longest_parked") {
+            // Example usage: longest_parked 10
+            long long n;
+            if (!readNumbers(n)) continue;
+            if (n <= 0) {
+                cout << "The count must be positive." << endl;
+                continue;
+            }
+            myGarage.showLongestParked(n);
+        } else if (cmd == "parked_longer") {
+            // Example usage: parked_longer 4320
+            long long minutes;
+            if (!readNumbers(minutes)) continue;
+            if (minutes < 0) {
+                cout << "The age can't be negative." << endl;
+                continue;
+            }
+            myGarage.showParkedLonger(minutes);
+        } else if (cmd == "run_oracle") {
+            // Example usage: run_oracle 1000000 256 7
+            long long ops;
+            int slots;
+            unsigned seed;
+            if (!readNumbers(ops, slots, seed)) continue;
+            if (ops <= 0 || slots <= 0) {
+                cout << "The operation and slot counts must be positive." << endl;
+                continue;
+            }
+            runAllocatorOracle(ops, slots, seed);
+        } else if (cmd == "registry_fill") {
+            // Example usage: registry_fill 1000000 7
+            long long count;
+            unsigned seed;
+            if (!readNumbers(count, seed)) continue;
+            if (count <= 0) {
+                cout << "The plate count must be positive." << endl;
+                continue;
+            }
+            runRegistryFill(count, seed);
+        } else if (cmd == "camera_bench") {
+            // Example usage: camera_bench 1000000 7
+            long long events;
+            unsigned seed;
+            if (!readNumbers(events, seed)) continue;
+            if (events <= 0) {
+                cout << "The event count must be positive." << endl;
+                continue;
+            }
+            runCameraBench(events, seed);
+        } else if (cmd == "clock_bench") {
+            // Example usage: clock_bench 10000000
+            long long reads;
+            if (!readNumbers(reads)) continue;
+            if (reads <= 0) {
+                cout << "The read count must be positive." << endl;
+                continue;
+            }
+            runClockBench(reads);
+        } else if (cmd == "counter_bench") {
+            // Example usage: counter_bench 4096 7
+            int slots;
+            unsigned seed;
+            if (!readNumbers(slots, seed)) continue;
+            if (slots <= 0) {
+                cout << "The slot count must be positive." << endl;
+                continue;
+            }
+            runCounterBench(slots, seed);
+        } else if (cmd == "perf_regress") {
+            // Example usage: perf_regress scenarios 0.25
+            string dir;
+            double tolerance;
+            cin >> dir;
+            if (!readNumbers(tolerance)) continue;
+            if (!(tolerance >= 0 && tolerance < 1)) {
+                cout << "The tolerance must be a fraction from 0 up to 1, e.g. 0.25." << endl;
+                continue;
+            }
+            runPerfRegression(dir, tolerance, false);
+        } else if (cmd == "perf_baseline") {
+            // Example usage: perf_baseline scenarios
+            string dir;
+            cin >> dir;
+            runPerfRegression(dir, 0, true);
+        } else if (cmd == "stress_test") {
+            // Example usage: stress_test 8 200000
+            // Runs on a separate scratch garage with the same geometry.
+            int threads;
+            long long ops;
+            if (!readNumbers(threads, ops)) continue;
+            if (threads <= 0 || ops <= 0) {
+                cout << "The thread and operation counts must be positive." << endl;
+                continue;
+            }
+            runStressTest(threads, ops, slotCounts);
+        } else if (cmd == "export_snapshot") {
+            // Example usage: export_snapshot garage.snap
+            string path;
+            cin >> path;
+            ofstream out(path, ios::binary);
+            if (out && myGarage.exportSnapshot(out)) {
+                cout << "Snapshot written to " << path << "." << endl;
+            } else {
+                cout << "Could not write snapshot to " << path << "." << endl;
+            }
+        } else if (cmd == "sensor_export") {
+            // Example usage: sensor_export sensors.bin
+            string path;
+            cin >> path;
+            ofstream out(path, ios::binary);
+            writeSensorFrame(out, myGarage.sensorView());
+            cout << (out ? "Sensor frame written to " + path + "." : "Could not write " + path + ".") << endl;
+        } else if (cmd == "reconcile") {
+            // Example usage: reconcile sensors.bin fix
+            string path, mode, error;
+            cin >> path >> mode;
+            ifstream in(path, ios::binary);
+            SensorFrame frame;
+            if (!readSensorFrame(in, frame, error) || !myGarage.reconcileSensors(frame, mode == "fix", error)) {
+                cout << "Could not reconcile " << path << ": " << error << "." << endl;
+            }
+        } else if (cmd == "import_snapshot") {
+            // Example usage: import_snapshot garage.snap
+            string path, error;
+            cin >> path;
+            ifstream in(path, ios::binary);
+            auto start = chrono::steady_clock::now();
+            if (!in) {
+                cout << "Could not open " << path << "." << endl;
+            } else if (!myGarage.importSnapshot(in, error)) {
+                cout << "Snapshot import failed: " << error << "." << endl;
+            } else {
+                double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                cout << "Snapshot imported from " << path << " in " << ms << " ms." << endl;
+            }
+        } else if (cmd == "wal_enable") {
+            // Example usage: wal_enable garage-log
+            string dir, error;
+            cin >> dir;
+            if (myGarage.enableLog(dir, error)) {
+                cout << "Logging every change to " << dir << "." << endl;
+            } else {
+                cout << "Could not enable the log: " << error << "." << endl;
+            }
+        } else if (cmd == "wal_recover") {
+            // Example usage: wal_recover garage-log
+            string dir, error;
+            cin >> dir;
+            long long replayed = myGarage.recoverFromLog(dir, error);
+            if (replayed >= 0) {
+                cout << "Recovered from " << dir << " (" << replayed << " record(s) replayed)." << endl;
+            } else {
+                cout << "Recovery failed: " << error << "." << endl;
+            }
+        } else if (cmd == "wal_stats") {
+            myGarage.showLogStats();
+        } else if (cmd == "hot_restart") {
+            // Example usage: hot_restart ./Design
+            string binary;
+            cin >> binary;
+            hotRestart(myGarage, binary);
         } else if (cmd == "commands") {
             // Just show the commands again.
             myGarage.showAllCommands();
@@ -352,3 +5108,75 @@ int main() {
 
     return 0;
 }
+
+///////////////////////////////////////////////////////////
+// Main function: A simple interface for our "Garage" system.
+///////////////////////////////////////////////////////////
+int main(int argc, char* argv[]) {
+    // Read stdin unbuffered so commands we haven't reached stay in the
+    // pipe for a hot-restarted successor.
+    setvbuf(stdin, nullptr, _IONBF, 0);
+
+    // Started by hot_restart: carry on from the predecessor's state.
+    if (argc > 2 && string(argv[1]) == "--handoff") {
+        Garage myGarage((GarageConfig()));
+        long long started = 0;
+        string error;
+        if (!resumeHandoff(myGarage, atoi(argv[2]), started, error)) {
+            cout << "Hot restart failed: " << error << "." << endl;
+            return 1;
+        }
+        double ms = (steadyNanos() - started) / 1e6;
+        cout << "Hot restart complete; commands paused for " << ms << " ms." << endl;
+        return runCommandLoop(myGarage, myGarage.levelSizes());
+    }
+
+    // With a config file the garage starts without any prompts.
+    if (argc > 1) {
+        auto start = chrono::steady_clock::now();
+        GarageConfig config;
+        string error;
+        if (!loadGarageConfig(argv[1], config, error)) {
+            cout << "Could not load config: " << error << "." << endl;
+            return 1;
+        }
+        Garage myGarage(config);
+        if (!config.logDir.empty() && !myGarage.openLog(config.logDir, error)) {
+            cout << "Could not open the log: " << error << "." << endl;
+            return 1;
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "Garage ready from " << argv[1] << " in " << ms << " ms." << endl;
+        return runCommandLoop(myGarage, config.slotCounts);
+    }
+
+    // Otherwise, let's ask the user how many levels and how many slots per level.
+    int levelCount;
+    cout << "Number of levels inyour parking lot garage: ";
+    if (!(cin >> levelCount) || levelCount <= 0) {
+        cout << "The garage needs at least one level." << endl;
+        return 1;
+    }
+    cout << "Number of slots/spots on each level (one number for all, or one per level): ";
+    vector<int> slotCounts;
+    string line;
+    getline(cin >> ws, line);
+    istringstream counts(line);
+    for (int n; counts >> n; ) {
+        if (n <= 0) {
+            cout << "Slot counts must be positive, got " << n << "." << endl;
+            return 1;
+        }
+        slotCounts.push_back(n);
+    }
+    if (slotCounts.size() == 1) slotCounts.assign(levelCount, slotCounts[0]);
+    if (int(slotCounts.size()) != levelCount) {
+        cout << "Expected 1 or " << levelCount << " slot count(s)." << endl;
+        return 1;
+    }
+
+    // Create the garage with the specified dimensions.
+    Garage myGarage(slotCounts);
+
+    return runCommandLoop(myGarage, slotCounts);
+}